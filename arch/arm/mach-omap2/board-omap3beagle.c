@@ -34,6 +34,7 @@
 
 #ifdef CONFIG_MACH_OMAP3_DEVKIT8000
 #include <linux/dm9000.h>
+#include <linux/sensirion-2wire.h>
 #endif
 
 #include <mach/hardware.h>
@@ -451,6 +452,24 @@ static struct platform_device omap_dm9000_dev = {
                 .platform_data = &omap_dm9000_platdata,
         },
 };
+
+/*
+ * SHT7x humidity/temperature sensor on the I2C3 pins, muxed as GPIO184
+ * (SCK) and GPIO185 (DATA).  Further sensors get their own device with
+ * another id and pin pair.
+ */
+static struct sensirion_2wire_platform_data devkit8000_sht7x_data = {
+	.sck_gpio	= 184,
+	.data_gpio	= 185,
+};
+
+static struct platform_device devkit8000_sht7x_device = {
+	.name	= "omap34xx_sht7x",
+	.id	= -1,
+	.dev	= {
+		.platform_data	= &devkit8000_sht7x_data,
+	},
+};
 #endif
 
 #define OMAP3_BEAGLE_TS_GPIO       27
@@ -642,8 +661,9 @@ MUX_CFG_34XX("AE15_34XX_I2C2_SDA", 0x1c0,
 /* Used by SHT7X sensor which cannot by address by I2C protocol */
 MUX_CFG_34XX("AF14_34XX_I2C3_SCL", 0x1c2,
 	     OMAP34XX_MUX_MODE4 | OMAP34XX_PIN_OUTPUT)
+/* DATA is read back (ACK, data bits, data-ready IRQ), so enable input */
 MUX_CFG_34XX("AG14_34XX_I2C3_SDA", 0x1c4,
-	     OMAP34XX_MUX_MODE4 | OMAP34XX_PIN_OUTPUT)
+	     OMAP34XX_MUX_MODE4 | OMAP34XX_PIN_INPUT_PULLUP)
 
 MUX_CFG_34XX("AD26_34XX_I2C4_SCL", 0xa00,
 	     OMAP34XX_MUX_MODE0 | OMAP34XX_PIN_INPUT_PULLUP)
@@ -878,6 +898,7 @@ static struct platform_device *omap3_beagle_devices[] __initdata = {
 	&keys_gpio,
 #ifdef CONFIG_MACH_OMAP3_DEVKIT8000
 	&omap_dm9000_dev,
+	&devkit8000_sht7x_device,
 #endif
 };
 
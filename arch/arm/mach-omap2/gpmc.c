@@ -54,6 +54,16 @@
 #define GPMC_CHUNK_SHIFT	24		/* 16 MB */
 #define GPMC_SECTION_SHIFT	28		/* 128 MB */
 
+/* GPMC_PREFETCH_CONFIG1 fields */
+#define PREFETCH_ACCESSMODE_WRITE	(1 << 0)
+#define PREFETCH_DMAMODE		(1 << 2)
+#define PREFETCH_ENABLEENGINE		(1 << 7)
+#define PREFETCH_FIFOTHRESHOLD(val)	(((val) & 0x7f) << 8)
+#define PREFETCH_ENGINECS(cs)		(((cs) & 0x7) << 24)
+
+/* GPMC_PREFETCH_CONTROL fields */
+#define PREFETCH_STARTENGINE		(1 << 0)
+
 /* Structure to save gpmc cs context */
 struct gpmc_cs_config {
 	u32 config1;
@@ -84,6 +94,7 @@ struct omap3_gpmc_regs {
 static struct resource	gpmc_mem_root;
 static struct resource	gpmc_cs_mem[GPMC_CS_NUM];
 static DEFINE_SPINLOCK(gpmc_mem_lock);
+static DEFINE_SPINLOCK(gpmc_prefetch_lock);
 static unsigned		gpmc_cs_map;
 static struct omap3_gpmc_regs gpmc_context;
 
@@ -411,6 +422,76 @@ void gpmc_cs_free(int cs)
 }
 EXPORT_SYMBOL(gpmc_cs_free);
 
+/*
+ * gpmc_prefetch_enable - start the prefetch/write-posting engine
+ * @cs: chip select the engine should access
+ * @dma_mode: 1 to raise sDMA requests at the FIFO threshold, 0 for MPU
+ * @count: number of bytes to transfer, at most GPMC_PREFETCH_MAX_COUNT
+ * @is_write: 0 to prefetch reads, 1 to post writes
+ *
+ * There is a single engine shared by all chip selects; -EBUSY is
+ * returned while another transfer owns it, in which case the caller is
+ * expected to fall back to plain accesses.
+ */
+int gpmc_prefetch_enable(int cs, int dma_mode, unsigned int count,
+			 int is_write)
+{
+	u32 l;
+
+	if (cs >= GPMC_CS_NUM || count == 0 || count > GPMC_PREFETCH_MAX_COUNT)
+		return -EINVAL;
+
+	spin_lock(&gpmc_prefetch_lock);
+	if (gpmc_read_reg(GPMC_PREFETCH_CONTROL) & PREFETCH_STARTENGINE) {
+		spin_unlock(&gpmc_prefetch_lock);
+		return -EBUSY;
+	}
+
+	gpmc_write_reg(GPMC_PREFETCH_CONFIG2, count);
+
+	l = PREFETCH_ENGINECS(cs) | PREFETCH_ENABLEENGINE |
+		PREFETCH_FIFOTHRESHOLD(GPMC_PREFETCH_FIFO_SIZE);
+	if (dma_mode)
+		l |= PREFETCH_DMAMODE;
+	if (is_write)
+		l |= PREFETCH_ACCESSMODE_WRITE;
+	gpmc_write_reg(GPMC_PREFETCH_CONFIG1, l);
+
+	gpmc_write_reg(GPMC_PREFETCH_CONTROL, PREFETCH_STARTENGINE);
+	spin_unlock(&gpmc_prefetch_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(gpmc_prefetch_enable);
+
+/*
+ * gpmc_prefetch_reset - stop and disable the prefetch engine
+ *
+ * Must be called by the owner once the transfer count reached zero, so
+ * that the engine can be handed to the next user.
+ */
+void gpmc_prefetch_reset(void)
+{
+	spin_lock(&gpmc_prefetch_lock);
+	gpmc_write_reg(GPMC_PREFETCH_CONTROL, 0);
+	gpmc_write_reg(GPMC_PREFETCH_CONFIG1, 0);
+	spin_unlock(&gpmc_prefetch_lock);
+}
+EXPORT_SYMBOL(gpmc_prefetch_reset);
+
+/*
+ * gpmc_prefetch_status - read GPMC_PREFETCH_STATUS
+ *
+ * Decode with GPMC_PREFETCH_STATUS_COUNT() for the bytes left to
+ * transfer and GPMC_PREFETCH_STATUS_FIFO_CNT() for the bytes available
+ * in the FIFO (reads) or free in it (writes).
+ */
+u32 gpmc_prefetch_status(void)
+{
+	return gpmc_read_reg(GPMC_PREFETCH_STATUS);
+}
+EXPORT_SYMBOL(gpmc_prefetch_status);
+
 static void __init gpmc_mem_init(void)
 {
 	int cs;
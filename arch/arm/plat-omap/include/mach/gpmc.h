@@ -64,6 +64,12 @@
 #define GPMC_CONFIG1_FCLK_DIV4          (GPMC_CONFIG1_FCLK_DIV(3))
 #define GPMC_CONFIG7_CSVALID		(1 << 6)
 
+/* Prefetch/write-posting engine */
+#define GPMC_PREFETCH_FIFO_SIZE		64
+#define GPMC_PREFETCH_MAX_COUNT		0x3fff
+#define GPMC_PREFETCH_STATUS_COUNT(val)		((val) & 0x3fff)
+#define GPMC_PREFETCH_STATUS_FIFO_CNT(val)	(((val) >> 24) & 0x7f)
+
 /*
  * Note that all values in this struct are in nanoseconds, while
  * the register values are in gpmc_fck cycles.
@@ -114,6 +120,10 @@ extern int gpmc_cs_request(int cs, unsigned long size, unsigned long *base);
 extern void gpmc_cs_free(int cs);
 extern int gpmc_cs_set_reserved(int cs, int reserved);
 extern int gpmc_cs_reserved(int cs);
+extern int gpmc_prefetch_enable(int cs, int dma_mode, unsigned int count,
+				int is_write);
+extern void gpmc_prefetch_reset(void);
+extern u32 gpmc_prefetch_status(void);
 extern void omap3_gpmc_save_context(void);
 extern void omap3_gpmc_restore_context(void);
 extern void __init gpmc_init(void);
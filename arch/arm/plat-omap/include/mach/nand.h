@@ -10,6 +10,15 @@
 
 #include <linux/mtd/partitions.h>
 
+/* ecc_opt: the ecc scheme used on a chip select */
+enum omap_ecc {
+	/* 1-bit Hamming with CONFIG_MTD_NAND_OMAP_HWECC, else software */
+	OMAP_ECC_HAMMING_CODE_DEFAULT = 0,
+	/* GPMC BCH engine (OMAP3630 and later), software correction */
+	OMAP_ECC_BCH4_CODE_HW,
+	OMAP_ECC_BCH8_CODE_HW,
+};
+
 struct omap_nand_platform_data {
 	unsigned int		options;
 	int			cs;
@@ -19,6 +28,7 @@ struct omap_nand_platform_data {
 	int			(*nand_setup)(void __iomem *);
 	int			(*dev_ready)(struct omap_nand_platform_data *);
 	int			dma_channel;
+	int			ecc_opt;
 	void __iomem		*gpmc_cs_baseaddr;
 	void __iomem		*gpmc_baseaddr;
 };
@@ -0,0 +1,210 @@
+/*
+ * hwmon-snapshot.c - one-shot capture of all hwmon channels
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * Drivers register their channels as struct hwmon_snapshot_source.
+ * Each read() of /dev/hwmon_snapshot reads every source in one pass and
+ * returns a single record stamped with one CLOCK_MONOTONIC time, so
+ * userspace correlating several sensors needs one system call instead
+ * of one sysfs read per attribute.  Slow sources start their conversions
+ * together before the record is stamped and are collected last, so the
+ * skew between values stays within one conversion time.  Sources are
+ * read without hwmon_snapshot_lock held.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/uaccess.h>
+#include <linux/hwmon-snapshot.h>
+
+/* largest number of channels per source */
+#define HWMON_SNAPSHOT_MAX_CHANNELS	8
+
+static LIST_HEAD(hwmon_snapshot_sources);
+/* protects the source list and the counts below */
+static DEFINE_MUTEX(hwmon_snapshot_lock);
+static unsigned int hwmon_snapshot_sources_nr;
+static unsigned int hwmon_snapshot_channels;
+/* woken up when a capture lets go of its sources */
+static DECLARE_WAIT_QUEUE_HEAD(hwmon_snapshot_wait);
+
+/**
+ * hwmon_snapshot_register - add a source to every future snapshot
+ * @src: source, must stay valid until hwmon_snapshot_unregister()
+ *
+ * Returns 0 on success, else negative errno.
+ */
+int hwmon_snapshot_register(struct hwmon_snapshot_source *src)
+{
+	if (!src->nchannels || src->nchannels > HWMON_SNAPSHOT_MAX_CHANNELS)
+		return -EINVAL;
+
+	atomic_set(&src->users, 0);
+
+	mutex_lock(&hwmon_snapshot_lock);
+	list_add_tail(&src->list, &hwmon_snapshot_sources);
+	hwmon_snapshot_sources_nr++;
+	hwmon_snapshot_channels += src->nchannels;
+	mutex_unlock(&hwmon_snapshot_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(hwmon_snapshot_register);
+
+/**
+ * hwmon_snapshot_unregister - remove a source
+ * @src: source
+ *
+ * Waits for a capture using @src to finish.
+ */
+void hwmon_snapshot_unregister(struct hwmon_snapshot_source *src)
+{
+	mutex_lock(&hwmon_snapshot_lock);
+	list_del(&src->list);
+	hwmon_snapshot_sources_nr--;
+	hwmon_snapshot_channels -= src->nchannels;
+	mutex_unlock(&hwmon_snapshot_lock);
+
+	wait_event(hwmon_snapshot_wait, !atomic_read(&src->users));
+}
+EXPORT_SYMBOL_GPL(hwmon_snapshot_unregister);
+
+/* read the values of @src into @v */
+static void hwmon_snapshot_fill(struct hwmon_snapshot_value *v,
+				struct hwmon_snapshot_source *src)
+{
+	s32 vals[HWMON_SNAPSHOT_MAX_CHANNELS];
+	unsigned int i;
+	int status;
+
+	memset(vals, 0, sizeof(vals));
+	status = src->read(src, vals);
+
+	for (i = 0; i < src->nchannels; i++, v++) {
+		snprintf(v->name, sizeof(v->name), "%s:%s",
+			 src->name, src->channels[i]);
+		v->value = status ? 0 : vals[i];
+		v->status = status;
+	}
+}
+
+/**
+ * hwmon_snapshot_capture - sample @nsrcs sources into @snap
+ * @snap: header, followed by room for all their values
+ * @srcs: sources, held by the caller
+ * @nsrcs: number of @srcs
+ *
+ * Sources with a ->prepare() method start converting first, then the
+ * record is stamped, then the quick sources are read while those
+ * conversions run, and the prepared ones are collected last.
+ */
+static void hwmon_snapshot_capture(struct hwmon_snapshot *snap,
+				   struct hwmon_snapshot_source **srcs,
+				   unsigned int nsrcs)
+{
+	struct hwmon_snapshot_value *v;
+	struct hwmon_snapshot_source *src;
+	unsigned int j;
+	int pass;
+
+	for (j = 0; j < nsrcs; j++)
+		if (srcs[j]->prepare)
+			srcs[j]->prepare(srcs[j]);
+
+	snap->timestamp = ktime_to_ns(ktime_get());
+	snap->value_size = sizeof(*v);
+
+	for (pass = 0; pass < 2; pass++) {
+		v = (void *)(snap + 1);
+		for (j = 0; j < nsrcs; j++) {
+			src = srcs[j];
+			if (!!src->prepare == pass)
+				hwmon_snapshot_fill(v, src);
+			v += src->nchannels;
+		}
+	}
+}
+
+static ssize_t hwmon_snapshot_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *pos)
+{
+	struct hwmon_snapshot_source **srcs = NULL;
+	struct hwmon_snapshot_source *src;
+	struct hwmon_snapshot *snap = NULL;
+	unsigned int i, nsrcs = 0;
+	size_t size;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&hwmon_snapshot_lock))
+		return -ERESTARTSYS;
+
+	size = sizeof(*snap) +
+	       hwmon_snapshot_channels * sizeof(struct hwmon_snapshot_value);
+	if (count < size) {
+		mutex_unlock(&hwmon_snapshot_lock);
+		return -EINVAL;
+	}
+
+	snap = kzalloc(size, GFP_KERNEL);
+	srcs = kmalloc(hwmon_snapshot_sources_nr * sizeof(*srcs), GFP_KERNEL);
+	if (!snap || !srcs) {
+		mutex_unlock(&hwmon_snapshot_lock);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* hold the sources, so unregistering waits for us */
+	list_for_each_entry(src, &hwmon_snapshot_sources, list) {
+		atomic_inc(&src->users);
+		srcs[nsrcs++] = src;
+	}
+	snap->count = hwmon_snapshot_channels;
+	mutex_unlock(&hwmon_snapshot_lock);
+
+	hwmon_snapshot_capture(snap, srcs, nsrcs);
+
+	for (i = 0; i < nsrcs; i++)
+		atomic_dec(&srcs[i]->users);
+	wake_up(&hwmon_snapshot_wait);
+
+	ret = copy_to_user(buf, snap, size) ? -EFAULT : size;
+
+out:
+	kfree(srcs);
+	kfree(snap);
+	return ret;
+}
+
+static const struct file_operations hwmon_snapshot_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nonseekable_open,
+	.read		= hwmon_snapshot_read,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice hwmon_snapshot_miscdev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "hwmon_snapshot",
+	.fops		= &hwmon_snapshot_fops,
+};
+
+static int __init hwmon_snapshot_init(void)
+{
+	return misc_register(&hwmon_snapshot_miscdev);
+}
+
+module_init(hwmon_snapshot_init);
+
+MODULE_DESCRIPTION("hwmon multi-sensor snapshot device");
+MODULE_LICENSE("GPL");
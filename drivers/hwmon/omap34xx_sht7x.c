@@ -22,489 +22,492 @@
 
 #include <linux/hrtimer.h>
 #include <linux/module.h>
-#include <linux/hwmon.h>
+#include <linux/device.h>
 #include <linux/hwmon-sysfs.h>
-#include <linux/err.h>
 #include <linux/platform_device.h>
-#include <linux/io.h>
-#include <linux/delay.h>
-#include <mach/omap34xx.h>
-#include <mach/control.h>
-#include <mach/mux.h>
+#include <linux/interrupt.h>
+#include <linux/bitrev.h>
+#include <linux/sensirion-2wire.h>
+#include "sensirion.h"
+
+/* bits in sht7x_data.flags */
+#define SHT7X_ARMED		0	/* waiting for data-ready */
 
 struct sht7x_data {
-	struct device 		*hwmon_dev;	// Linux hardware minotoring
-	struct mutex 		lock;		// Semphoare variable
-	const char 		*name;
-	char 			valid;
-	unsigned long 		last_updated;
-	u32 			temperature;	// Temperature
-	u32 			humidity;	// Humidity
-	u16			valueT;
-	u16			valueH;
-};
+	struct sensirion_sensor	sensor;
+	char			devname[16];	/* misc device name */
 
-static struct platform_device omap34xx_sht7x_device = {
-	.name 	= "omap34xx_sht7x",
-	.id	= -1,
-};
+	struct sensirion_2wire	bus;
+	u8			status_reg;	/* sensor status register */
+	u8			cmd;		/* command in flight */
 
-/*********************** internal ******************************/
+	unsigned long		flags;
+	int			irq;		/* data-ready IRQ, -1 if polled */
+	struct hrtimer		timer;		/* timeout, or poll tick */
+	ktime_t			deadline;	/* end of conversion window */
+};
 
-#define OMAP34XX_GPIO6_BASE             IO_ADDRESS(0x49058000)
-#define OMAP34XX_GPIO6_OE               IO_ADDRESS(0x49058000+0x34)
-#define OMAP34XX_GPIO6_DATAOUT          IO_ADDRESS(0x49058000+0x3c)
-#define OMAP34XX_GPIO6_DATAIN           IO_ADDRESS(0x49058000+0x38)
-
-/* GPIO OE bits */
-#define	GPIO_184		(23)
-#define	GPIO_185		(24)
-
-/* GPIO direction, 0 - output, 1 - input */
-#define GPIO_184_OUTPUT		(~(0x1<<GPIO_184))
-#define GPIO_185_OUTPUT		(~(0x1<<GPIO_185))
-#define GPIO_184_INPUT		(0x1<<GPIO_184)
-#define GPIO_185_INPUT		(0x1<<GPIO_185)
-
-/* GPIO pull High/Low */
-#define GPIO_184_HIGH		(0x1<<GPIO_184)
-#define GPIO_185_HIGH		(0x1<<GPIO_185)
-#define GPIO_184_LOW		(~(0x1<<GPIO_184))
-#define GPIO_185_LOW		(~(0x1<<GPIO_185))
-
-/* Set GPIO direction */
-static __inline void set_gpio_184_output()
+static inline struct sht7x_data *to_sht7x(struct sensirion_sensor *sensor)
 {
-   u32 val = __raw_readl(OMAP34XX_GPIO6_OE);
-   val &= (GPIO_184_OUTPUT);
-    __raw_writel(val, OMAP34XX_GPIO6_OE);
+	return container_of(sensor, struct sht7x_data, sensor);
 }
 
-static __inline void set_gpio_185_output()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_OE);
-   val &= (GPIO_185_OUTPUT);
-    __raw_writel(val, OMAP34XX_GPIO6_OE);
-}
+/*********************** internal ******************************/
 
-static __inline void set_gpio_184_input()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_OE);
-   val |= (GPIO_184_INPUT);
-    __raw_writel(val, OMAP34XX_GPIO6_OE);
-}
+typedef enum {
+	SHT_MEASURE_TEMP	= 0x03,
+	SHT_MEASURE_HUMI	= 0x05,
+	SHT_WRITE_STATUS	= 0x06,
+	SHT_READ_STATUS		= 0x07,
+	SHT_SOFT_RESET		= 0x1e,
+} SHTXX_CMD_e;
 
-static __inline void set_gpio_185_input()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_OE);
-   val |= (GPIO_185_INPUT);
-    __raw_writel(val, OMAP34XX_GPIO6_OE);
-}
+/* status register bits (data sheet 4.4) */
+#define SHT7X_STATUS_LOW_RES	0x01	/* 12bit T / 8bit RH */
+#define SHT7X_STATUS_NO_RELOAD	0x02	/* don't reload OTP calibration */
+#define SHT7X_STATUS_HEATER	0x04
+#define SHT7X_STATUS_LOW_BAT	0x40	/* VDD below 2.47V, read-only */
+#define SHT7X_STATUS_WRITABLE	(SHT7X_STATUS_LOW_RES | \
+				 SHT7X_STATUS_NO_RELOAD | \
+				 SHT7X_STATUS_HEATER)
 
-/* GPIO High/Low */
-static __inline void gpio_184_high()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_DATAOUT);
-   val |= (GPIO_184_HIGH);
-    __raw_writel(val, OMAP34XX_GPIO6_DATAOUT);
-}
+/*
+ * Conversion timeouts in ns, indexed by the resolution bit: data sheet
+ * 3.3 gives max 320/80/20ms for 14/12/8bit, plus some margin.
+ */
+static const u64 sht7x_timeout_t[] = {
+	400 * NSEC_PER_MSEC,
+	100 * NSEC_PER_MSEC,
+};
 
-static __inline void gpio_185_high()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_DATAOUT);
-   val |= (GPIO_185_HIGH);
-    __raw_writel(val, OMAP34XX_GPIO6_DATAOUT);
-}
+static const u64 sht7x_timeout_rh[] = {
+	100 * NSEC_PER_MSEC,
+	30 * NSEC_PER_MSEC,
+};
 
-static __inline void gpio_184_low()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_DATAOUT);
-   val |= (GPIO_184_LOW);
-    __raw_writel(val, OMAP34XX_GPIO6_DATAOUT);
-}
+/* data-ready poll interval when DATA has no usable IRQ */
+#define SHT7X_POLL_INTERVAL	(10 * NSEC_PER_MSEC)
 
-static __inline void gpio_185_low()
+/**
+ * sht7x_data_ready - end the conversion window
+ * @sht7x: device
+ * @status: 0 if DATA went low, else negative errno
+ *
+ * Called from the data-ready IRQ or from the hrtimer, whichever comes
+ * first; the ARMED bit makes sure only one of them hands over to the
+ * core.
+ */
+static void sht7x_data_ready(struct sht7x_data *sht7x, int status)
 {
-   u32 val = __raw_readl(OMAP34XX_GPIO6_DATAOUT);
-   val |= (GPIO_185_LOW);
-    __raw_writel(val, OMAP34XX_GPIO6_DATAOUT);
-}
+	if (!test_and_clear_bit(SHT7X_ARMED, &sht7x->flags))
+		return;
 
-/* GPIO 185 Data In */
-static __inline u32 gpio_185_read()
-{
-   u32 val = __raw_readl(OMAP34XX_GPIO6_DATAIN);
-   val &= (0x1<<GPIO_185);
-   return val;
+	if (sht7x->irq >= 0)
+		disable_irq_nosync(sht7x->irq);
+	sensirion_data_ready(&sht7x->sensor, status);
 }
 
+static irqreturn_t sht7x_irq(int irq, void *dev_id)
+{
+	struct sht7x_data *sht7x = dev_id;
 
-//#define	SHT_SCL	(1<<17)
-//#define	SHT_SDA (1<<16)
+	/* ignore edges latched while we were clocking the bus */
+	if (sensirion_2wire_data_ready(&sht7x->bus))
+		sht7x_data_ready(sht7x, 0);
 
-#define SHT_PORT_IN	  gpio_185_read()
+	return IRQ_HANDLED;
+}
 
-#define SHT_SCL_HIGH()    do{gpio_184_high();} while(0)
-#define SHT_SCL_LOW()     do{gpio_184_low();} while(0)
-#define SHT_SDA_HIGH()    do{gpio_185_high();} while(0)
-#define SHT_SDA_LOW()     do{gpio_185_low();} while(0)
+static enum hrtimer_restart sht7x_timer(struct hrtimer *timer)
+{
+	struct sht7x_data *sht7x = container_of(timer, struct sht7x_data,
+						timer);
 
+	if (sensirion_2wire_data_ready(&sht7x->bus)) {
+		sht7x_data_ready(sht7x, 0);
+		return HRTIMER_NORESTART;
+	}
 
-/*Delay Function*/
-/*   Delay time = (13 + 4*value) * 1000us -> 3.82us*value    */
-#define delay_sht()	  udelay(7)
+	if (sht7x->irq >= 0 ||
+	    ktime_to_ns(ktime_sub(sht7x->deadline, ktime_get())) <= 0) {
+		sht7x_data_ready(sht7x, -ETIMEDOUT);
+		return HRTIMER_NORESTART;
+	}
 
-static inline void pulse_sht(void)
-{
-   SHT_SCL_HIGH();    //CLOCK pulse -> approx 1.67us;
-   delay_sht();
-   SHT_SCL_LOW();
-   delay_sht();
+	hrtimer_forward_now(timer, ns_to_ktime(SHT7X_POLL_INTERVAL));
+	return HRTIMER_RESTART;
 }
 
-typedef enum {
-	SHT_MEASURE_TEMP	= 0x03,
-	SHT_MEASURE_HUMI	= 0x05,
-	SHT_SOFT_RESET		= 0x1e,
-} SHTXX_CMD_e;
-
-static void shtxx_Initial(void)
+/**
+ * sht7x_start - send a measurement command and arm data-ready detection
+ * @sensor: sensor
+ * @channel: quantity to convert
+ *
+ * Returns 0, or -EIO if the sensor did not acknowledge the command.
+ */
+static int sht7x_start(struct sensirion_sensor *sensor,
+		       enum sensirion_channel channel)
 {
-   u8 i;
-
-   // Connection reset sequence
-   SHT_SDA_HIGH();
-   delay_sht();
-   SHT_SCL_LOW();
-   delay_sht();
-
-   for(i = 0; i < 9; i++){
-       SHT_SCL_HIGH();
-       delay_sht();
-       SHT_SCL_LOW();
-       delay_sht();
-       //delay 1ms
-       udelay(1000);
-   }
-}
+	struct sht7x_data *sht7x = to_sht7x(sensor);
+	int res = sht7x->status_reg & SHT7X_STATUS_LOW_RES;
+	u64 timeout;
+	int err;
 
-static void shtxx_start_transmission(void)
-{
-       delay_sht();
-       SHT_SDA_HIGH();
-       delay_sht();
-       SHT_SCL_LOW();           //Initial state
-       delay_sht();
-       SHT_SCL_HIGH();
-       delay_sht();
-       SHT_SDA_LOW();
-       delay_sht();
-       SHT_SCL_LOW();
-       delay_sht();
-       SHT_SCL_HIGH();
-       delay_sht();
-       SHT_SDA_HIGH();
-       delay_sht();
-       SHT_SCL_LOW();
-       delay_sht();
-       //delay 1ms
-       udelay(1000);
-}
+	if (channel == SENSIRION_T) {
+		sht7x->cmd = SHT_MEASURE_TEMP;
+		timeout = sht7x_timeout_t[res];
+	} else {
+		sht7x->cmd = SHT_MEASURE_HUMI;
+		timeout = sht7x_timeout_rh[res];
+	}
 
+	sensirion_2wire_start(&sht7x->bus);
+	err = sensirion_2wire_write_byte(&sht7x->bus, sht7x->cmd);
+	if (err)
+		/* not acknowledged, no conversion will follow */
+		return err;
+
+	sht7x->deadline = ktime_add_ns(ktime_get(), timeout);
+	set_bit(SHT7X_ARMED, &sht7x->flags);
+
+	if (sht7x->irq >= 0) {
+		enable_irq(sht7x->irq);
+		hrtimer_start(&sht7x->timer, sht7x->deadline,
+			      HRTIMER_MODE_ABS);
+	} else {
+		hrtimer_start(&sht7x->timer, ns_to_ktime(SHT7X_POLL_INTERVAL),
+			      HRTIMER_MODE_REL);
+	}
 
-u8 shtxx_write_byte(unsigned char output)
-{
-   u32 sWait;
-   u8 i;
-
-   for(i = 0; i < 8; i++)
-   {
-       if(output & 0x80)
-           SHT_SDA_HIGH();
-       else
-           SHT_SDA_LOW();
-       delay_sht();
-       output <<= 1;
-       pulse_sht();
-       delay_sht();
-   }
-   SHT_SDA_HIGH();                     //release DATA-line
-   delay_sht();
-   pulse_sht();
-   delay_sht();
-   SHT_SDA_HIGH();
-   delay_sht();
-
-   sWait = 4000000;                    //Avoid infinity loop
-   while(sWait-- > 0){
-       if(!(SHT_PORT_IN)){     //!!! Wait for sensing finish
-           return true;
-       }
-   }
-
-   return false;
+	return 0;
 }
 
-u8 shtxx_write_byte_no_wait(unsigned char output)
+/**
+ * sht7x_read - clock a 16 bit measurement result out of the sensor
+ * @sensor: sensor
+ * @channel: quantity converted
+ * @ticks: result
+ *
+ * Reads the two data bytes and the CRC, which covers the command byte
+ * and both data bytes, starts from the bit-reversed low nibble of the
+ * status register and is transmitted bit-reversed (datasheet 4.5).
+ *
+ * Returns 0 on success, -EBADMSG on CRC mismatch.
+ */
+static int sht7x_read(struct sensirion_sensor *sensor,
+		      enum sensirion_channel channel, u16 *ticks)
 {
-   u8 i;
-   for(i = 0; i < 8; i++)
-   {
-       if(output & 0x80)
-           SHT_SDA_HIGH();
-       else
-           SHT_SDA_LOW();
-       delay_sht();
-       output <<= 1;
-       pulse_sht();
-       delay_sht();
-   }
-   SHT_SDA_HIGH();                //release DATA-line
-   delay_sht();
-   pulse_sht();
-   delay_sht();
-   SHT_SDA_HIGH();
-   delay_sht();
-   return true;
-}
+	struct sht7x_data *sht7x = to_sht7x(sensor);
+	u8 buf[3];
+	u8 crc;
+
+	/* the timeout may still be pending after data-ready */
+	hrtimer_cancel(&sht7x->timer);
+
+	buf[0] = sht7x->cmd;
+	buf[1] = sensirion_2wire_read_byte(&sht7x->bus, 1);
+	buf[2] = sensirion_2wire_read_byte(&sht7x->bus, 1);
+	crc = sensirion_2wire_read_byte(&sht7x->bus, 0);
+
+	if (sensirion_crc8(bitrev8(sht7x->status_reg & 0x0f),
+			   buf, sizeof(buf)) != bitrev8(crc)) {
+		sensor->crc_errors++;
+		return -EBADMSG;
+	}
 
-int shtxx_read_word(void)
-{
-   unsigned int input = 0;
-   u8 i;
-
-   SHT_SDA_HIGH();
-   for(i = 0; i < 16; i++)
-   {
-       delay_sht();
-       if (SHT_PORT_IN)
-           input |= 0x0001;
-       if (i != 15)
-           input <<= 1;
-       if (i == 7)
-       {
-           pulse_sht();
-           delay_sht();
-           SHT_SDA_LOW();
-           delay_sht();
-           pulse_sht();
-           delay_sht();
-           SHT_SDA_HIGH();     //release the dataline
-           delay_sht();
-       }
-       else
-       {
-           pulse_sht();
-           delay_sht();
-       }
-   }
-   SHT_SDA_HIGH();             //ACK ...........no CRC
-   delay_sht();
-   pulse_sht();
-   delay_sht();
-
-   return input;
+	*ticks = (buf[1] << 8) | buf[2];
+	return 0;
 }
 
-static void shtxx_read_TH(struct sht7x_data *pResTH)
+/* get the sensor's interface back into a known state */
+static void sht7x_recover(struct sensirion_sensor *sensor)
 {
-   u8 resT, resH;
-
-   /* 1. Measure Temperature */
-   shtxx_start_transmission();                     //Start Transmission
-   resT = shtxx_write_byte(SHT_MEASURE_TEMP);      //Write commmand
-   if(resT == true){
-       pResTH->valueT = shtxx_read_word();         //Read Temperature
-   }
-
-   /* 2. Measure Humidity */
-   shtxx_start_transmission();                     //Start transmission with sensor
-   resH = shtxx_write_byte(SHT_MEASURE_HUMI);      //Write commmand
-   if(resH == true){
-       pResTH->valueH = shtxx_read_word();         //Read Humidity 
-   }
-   /* 3. Convert result */
-   //¨ìap¼h¦b°µ¹Bºâ¡A¦]¬°Driver¤£¤ä´©¯BÂI¼Æ
-   //shtxx_convert_TH(resT, resH, valueT, valueH, pResTH);
-
-   if(resT && resH){
-       pResTH->temperature = 0;
-       pResTH->humidity    = 0;
-   }
-   else{
-       pResTH->valueT      = 0;
-       pResTH->valueH      = 0;
-       pResTH->temperature = 0xFFFF;
-       pResTH->humidity    = 0xFFFF;
-   }
+	sensirion_2wire_reset(&to_sht7x(sensor)->bus);
 }
 
+static const struct sensirion_ops sht7x_ops = {
+	.start		= sht7x_start,
+	.read		= sht7x_read,
+	.recover	= sht7x_recover,
+};
 
-/***************************************************************/
-
-static void sht7x_update(struct sht7x_data *sht7x)
+/**
+ * sht7x_read_status - read the status register into sht7x->status_reg
+ * @sht7x: device, lock held and no cycle running
+ *
+ * Returns 0 on success, else negative errno.
+ */
+static int sht7x_read_status(struct sht7x_data *sht7x)
 {
-	u32 temp_sensor_reg;
+	u8 buf[2];
+	u8 crc;
+	int err;
 
-	mutex_lock(&sht7x->lock);
+	sensirion_2wire_start(&sht7x->bus);
+	err = sensirion_2wire_write_byte(&sht7x->bus, SHT_READ_STATUS);
+	if (err)
+		return err;
 
-	if (time_after(jiffies, sht7x->last_updated + HZ / 2) || !sht7x->valid) {
-		shtxx_read_TH(sht7x);
+	buf[0] = SHT_READ_STATUS;
+	buf[1] = sensirion_2wire_read_byte(&sht7x->bus, 1);
+	crc = sensirion_2wire_read_byte(&sht7x->bus, 0);
 
-		sht7x->last_updated = jiffies;
-		sht7x->valid = 1;
+	/* the CRC is seeded with the register being read */
+	if (sensirion_crc8(bitrev8(buf[1] & 0x0f),
+			   buf, sizeof(buf)) != bitrev8(crc)) {
+		sht7x->sensor.crc_errors++;
+		return -EBADMSG;
 	}
 
-	mutex_unlock(&sht7x->lock);
+	sht7x->status_reg = buf[1];
+	sht7x->sensor.resolution = buf[1] & SHT7X_STATUS_LOW_RES;
+	return 0;
 }
 
 /**
- * show_name - 
- * @dev: 
- * @devattr: 
- * @buf: 
+ * sht7x_write_status - update the writable status register bits
+ * @sht7x: device, lock held and no cycle running
+ * @val: new value of the SHT7X_STATUS_WRITABLE bits
  *
+ * Reads the register back to make sure the sensor took the value.
  * Returns 0 on success, else negative errno.
  */
-static ssize_t show_name(struct device *dev,
-			struct device_attribute *devattr, char *buf)
+static int sht7x_write_status(struct sht7x_data *sht7x, u8 val)
 {
-	struct sht7x_data *data = dev_get_drvdata(dev);
+	int retry, err = 0;
+
+	for (retry = 0; retry <= SENSIRION_RETRIES; retry++) {
+		if (retry) {
+			sht7x->sensor.retries++;
+			sensirion_2wire_reset(&sht7x->bus);
+		}
+
+		sensirion_2wire_start(&sht7x->bus);
+		err = sensirion_2wire_write_byte(&sht7x->bus,
+						 SHT_WRITE_STATUS);
+		if (!err)
+			err = sensirion_2wire_write_byte(&sht7x->bus, val);
+		if (!err)
+			err = sht7x_read_status(sht7x);
+		if (!err && (sht7x->status_reg & SHT7X_STATUS_WRITABLE) != val)
+			err = -EIO;
+		if (!err)
+			return 0;
+	}
 
-	return sprintf(buf, "%s\n", data->name);
+	return err;
 }
 
+/***************************************************************/
+
 /**
- * show_temp - 
- * @dev: 
- * @devattr: 
- * @buf: 
+ * show_status_bit - show a status register control
+ * @dev: hwmon device of the sensor
+ * @devattr: index is the status bit, nr is 1 if the control is inverted
+ * @buf: page to print 0 or 1 to
  *
- * Returns 0 on success, else negative errno.
+ * Returns the number of bytes written to @buf.
  */
-static ssize_t show_temp(struct device *dev,
+static ssize_t show_status_bit(struct device *dev,
 			 struct device_attribute *devattr, char *buf)
 {
-	struct sht7x_data *data = dev_get_drvdata(dev);
+	struct sht7x_data *data = to_sht7x(dev_get_drvdata(dev));
+	struct sensor_device_attribute_2 *attr = to_sensor_dev_attr_2(devattr);
 
-	sht7x_update(data);
-
-	return sprintf(buf, "%d\n", data->temperature);
+	return sprintf(buf, "%d\n",
+		       !!(data->status_reg & attr->index) ^ attr->nr);
 }
 
 /**
- * show_humidity - 
- * @dev: 
- * @devattr: 
- * @buf: 
+ * set_status_bit - change a status register control
+ * @dev: hwmon device of the sensor
+ * @devattr: index is the status bit, nr is 1 if the control is inverted
+ * @buf: 0 or 1
+ * @count: length of @buf
  *
- * Returns 0 on success, else negative errno.
+ * Waits for a running measurement to finish.  A resolution change
+ * invalidates the cached values.
+ * Returns @count on success, else negative errno.
  */
-static ssize_t show_humidity(struct device *dev,
-			 struct device_attribute *devattr, char *buf)
+static ssize_t set_status_bit(struct device *dev,
+			 struct device_attribute *devattr,
+			 const char *buf, size_t count)
 {
-	struct sht7x_data *data = dev_get_drvdata(dev);
+	struct sht7x_data *data = to_sht7x(dev_get_drvdata(dev));
+	struct sensor_device_attribute_2 *attr = to_sensor_dev_attr_2(devattr);
+	unsigned long val;
+	u8 status;
+	int err;
 
-	sht7x_update(data);
+	if (strict_strtoul(buf, 10, &val) || val > 1)
+		return -EINVAL;
 
-	return sprintf(buf, "%d\n", data->humidity);
+	err = sensirion_lock_idle(&data->sensor);
+	if (err)
+		return err;
+
+	status = data->status_reg & SHT7X_STATUS_WRITABLE & ~attr->index;
+	if (val ^ attr->nr)
+		status |= attr->index;
+	err = sht7x_write_status(data, status);
+	if (attr->index == SHT7X_STATUS_LOW_RES)
+		sensirion_invalidate(&data->sensor);
+
+	sensirion_unlock(&data->sensor);
+
+	return err ? err : count;
 }
 
-static SENSOR_DEVICE_ATTR_2(temp1_input, S_IRUGO, show_temp, NULL, 0, 0);
-static SENSOR_DEVICE_ATTR_2(humidity1_input, S_IRUGO, show_humidity, NULL, 0, 0);
-static DEVICE_ATTR(name, S_IRUGO, show_name, NULL);
+static SENSOR_DEVICE_ATTR_2(low_resolution, S_IWUSR | S_IRUGO,
+			    show_status_bit, set_status_bit,
+			    0, SHT7X_STATUS_LOW_RES);
+static SENSOR_DEVICE_ATTR_2(heater_enable, S_IWUSR | S_IRUGO,
+			    show_status_bit, set_status_bit,
+			    0, SHT7X_STATUS_HEATER);
+static SENSOR_DEVICE_ATTR_2(otp_reload, S_IWUSR | S_IRUGO,
+			    show_status_bit, set_status_bit,
+			    1, SHT7X_STATUS_NO_RELOAD);
+
+static struct attribute *sht7x_attributes[] = {
+	&sensor_dev_attr_low_resolution.dev_attr.attr,
+	&sensor_dev_attr_heater_enable.dev_attr.attr,
+	&sensor_dev_attr_otp_reload.dev_attr.attr,
+	NULL
+};
+
+static const struct attribute_group sht7x_attr_group = {
+	.attrs = sht7x_attributes,
+};
 
-static int __devinit omap34xx_sht7x_probe(void)
+/**
+ * omap34xx_sht7x_probe - bind one sensor
+ * @pdev: platform device carrying struct sensirion_2wire_platform_data
+ *
+ * Returns 0 on success, else negative errno.
+ */
+static int __devinit omap34xx_sht7x_probe(struct platform_device *pdev)
 {
-	int err;
+	struct sensirion_2wire_platform_data *pdata = pdev->dev.platform_data;
 	struct sht7x_data *data;
+	int err;
 
-	err = platform_device_register(&omap34xx_sht7x_device);
-	if (err) {
-		printk(KERN_ERR
-			"Unable to register omap34xx SHT7x humidity and temperature sensor\n");
-		goto exit;
+	if (!pdata) {
+		dev_err(&pdev->dev, "no platform data\n");
+		return -EINVAL;
 	}
 
 	data = kzalloc(sizeof(struct sht7x_data), GFP_KERNEL);
-	if (!data) {
-		err = -ENOMEM;
-		goto exit_platform;
-	}
+	if (!data)
+		return -ENOMEM;
 
-	/* first initialized */
-	data->last_updated = jiffies;
-	shtxx_Initial();
-
-	dev_set_drvdata(&omap34xx_sht7x_device.dev, data);
-	mutex_init(&data->lock);
-	data->name = "omap34xx_sht7x";
-
-	err = device_create_file(&omap34xx_sht7x_device.dev,
-				 &sensor_dev_attr_temp1_input.dev_attr);
-	if (err)
+	err = sensirion_2wire_init(&data->bus, pdata, dev_name(&pdev->dev));
+	if (err) {
+		dev_err(&pdev->dev, "unable to claim GPIO%u/GPIO%u\n",
+			pdata->sck_gpio, pdata->data_gpio);
 		goto exit_free;
+	}
 
-	err = device_create_file(&omap34xx_sht7x_device.dev,
-				 &sensor_dev_attr_humidity1_input.dev_attr);
-	if (err)
-		goto exit_remove;
+	sensirion_2wire_reset(&data->bus);
 
-	err = device_create_file(&omap34xx_sht7x_device.dev, &dev_attr_name);
-	if (err)
-		goto exit_remove_humidity;
+	/* the status register survives a reboot without power cycle */
+	if (sht7x_read_status(data))
+		dev_warn(&pdev->dev, "unable to read status register\n");
 
-	data->hwmon_dev = hwmon_device_register(&omap34xx_sht7x_device.dev);
+	hrtimer_init(&data->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	data->timer.function = sht7x_timer;
 
-	if (IS_ERR(data->hwmon_dev)) {
-		err = PTR_ERR(data->hwmon_dev);
-		goto exit_remove_all;
+	/* the sensor signals data-ready by pulling DATA low */
+	data->irq = sensirion_2wire_to_irq(&data->bus);
+	if (data->irq < 0 ||
+	    request_irq(data->irq, sht7x_irq, IRQF_TRIGGER_FALLING,
+			dev_name(&pdev->dev), data)) {
+		dev_info(&pdev->dev, "no data-ready IRQ, polling\n");
+		data->irq = -1;
+	} else {
+		disable_irq(data->irq);
 	}
 
-        printk(KERN_INFO "omap34xx_sht7x: driver registered\n");
+	/* /dev/sht7x for a single sensor, /dev/sht7x<id> otherwise */
+	if (pdev->id < 0)
+		strlcpy(data->devname, "sht7x", sizeof(data->devname));
+	else
+		snprintf(data->devname, sizeof(data->devname), "sht7x%d",
+			 pdev->id);
+
+	data->sensor.dev = &pdev->dev;
+	data->sensor.name = "omap34xx_sht7x";
+	data->sensor.devname = data->devname;
+	data->sensor.family = SENSIRION_SHT7X;
+	data->sensor.ops = &sht7x_ops;
+	data->sensor.attrs = &sht7x_attr_group;
+
+	err = sensirion_register(&data->sensor);
+	if (err)
+		goto exit_irq;
+
+	dev_info(&pdev->dev, "SHT7x on GPIO%u (SCK) / GPIO%u (DATA)\n",
+		 pdata->sck_gpio, pdata->data_gpio);
 
 	return 0;
 
-exit_remove_all:
-	device_remove_file(&omap34xx_sht7x_device.dev,
-			   &dev_attr_name);
-exit_remove_humidity:
-	device_remove_file(&omap34xx_sht7x_device.dev,
-			   &sensor_dev_attr_humidity1_input.dev_attr);
-exit_remove:
-	device_remove_file(&omap34xx_sht7x_device.dev,
-			   &sensor_dev_attr_temp1_input.dev_attr);
+exit_irq:
+	if (data->irq >= 0)
+		free_irq(data->irq, data);
+	sensirion_2wire_free(&data->bus);
 exit_free:
 	kfree(data);
-exit_platform:
-	platform_device_unregister(&omap34xx_sht7x_device);
-exit:
 	return err;
 }
 
+static int __devexit omap34xx_sht7x_remove(struct platform_device *pdev)
+{
+	struct sht7x_data *data = to_sht7x(platform_get_drvdata(pdev));
+
+	sensirion_unregister(&data->sensor);
+
+	hrtimer_cancel(&data->timer);
+	if (data->irq >= 0)
+		free_irq(data->irq, data);
+	sensirion_2wire_free(&data->bus);
+	kfree(data);
+
+	return 0;
+}
+
+#ifdef CONFIG_PM
+static int omap34xx_sht7x_suspend(struct platform_device *pdev,
+				  pm_message_t state)
+{
+	return sensirion_suspend(platform_get_drvdata(pdev));
+}
+#else
+#define omap34xx_sht7x_suspend	NULL
+#endif
+
+static struct platform_driver omap34xx_sht7x_driver = {
+	.probe		= omap34xx_sht7x_probe,
+	.remove		= __devexit_p(omap34xx_sht7x_remove),
+	.suspend	= omap34xx_sht7x_suspend,
+	.driver		= {
+		.name	= "omap34xx_sht7x",
+		.owner	= THIS_MODULE,
+	},
+};
+
 static int __init omap34xx_sht7x_init(void)
 {
-	return omap34xx_sht7x_probe();
+	return platform_driver_register(&omap34xx_sht7x_driver);
 }
 
 static void __exit omap34xx_sht7x_exit(void)
 {
-	struct sht7x_data *data =
-			dev_get_drvdata(&omap34xx_sht7x_device.dev);
-
-	hwmon_device_unregister(data->hwmon_dev);
-	device_remove_file(&omap34xx_sht7x_device.dev, &dev_attr_name);
-	device_remove_file(&omap34xx_sht7x_device.dev,
-			   &sensor_dev_attr_humidity1_input.dev_attr);
-	device_remove_file(&omap34xx_sht7x_device.dev,
-			   &sensor_dev_attr_temp1_input.dev_attr);
-	kfree(data);
-	platform_device_unregister(&omap34xx_sht7x_device);
+	platform_driver_unregister(&omap34xx_sht7x_driver);
 }
 
 MODULE_AUTHOR("Jollen Chen");
 MODULE_DESCRIPTION("SHT7x humidity and temperature sensor for OMAP34xx");
 MODULE_LICENSE("GPL");
+MODULE_ALIAS("platform:omap34xx_sht7x");
 
 module_init(omap34xx_sht7x_init)
 module_exit(omap34xx_sht7x_exit)
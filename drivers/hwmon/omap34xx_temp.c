@@ -26,6 +26,7 @@
 #include <linux/module.h>
 #include <linux/hwmon.h>
 #include <linux/hwmon-sysfs.h>
+#include <linux/hwmon-snapshot.h>
 #include <linux/err.h>
 #include <linux/platform_device.h>
 #include <linux/io.h>
@@ -59,6 +60,7 @@ struct omap34xx_data {
 	char valid;
 	unsigned long last_updated;
 	u32 temp;
+	struct hwmon_snapshot_source snapshot;
 };
 
 static struct platform_device omap34xx_temp_device = {
@@ -97,9 +99,10 @@ static inline u32 wait_for_eocz(int min_delay, int max_delay, u32 level)
 	return (temp_sensor_reg & TEMP_SENSOR_EOCZ) == level;
 }
 
-static void omap34xx_update(struct omap34xx_data *data)
+static int omap34xx_update(struct omap34xx_data *data)
 {
 	u32 temp_sensor_reg;
+	int ret = 0;
 
 	mutex_lock(&data->update_lock);
 
@@ -128,12 +131,17 @@ static void omap34xx_update(struct omap34xx_data *data)
 						((1<<7) - 1);
 		data->last_updated = jiffies;
 		data->valid = 1;
+		goto out;
 
 err:
+		ret = -ETIMEDOUT;
+out:
 		clk_disable(data->clk_32k);
 	}
 
 	mutex_unlock(&data->update_lock);
+
+	return ret;
 }
 
 static ssize_t show_name(struct device *dev,
@@ -164,6 +172,25 @@ static ssize_t show_temp(struct device *dev,
 	return sprintf(buf, "%d\n", adc_to_temp[data->temp]);
 }
 
+static const char * const omap34xx_snapshot_channels[] = {
+	"temp1",
+};
+
+/* die temperature in celsius, as temp1_input */
+static int omap34xx_snapshot_read(struct hwmon_snapshot_source *src,
+				  s32 *vals)
+{
+	struct omap34xx_data *data =
+			container_of(src, struct omap34xx_data, snapshot);
+	int ret = omap34xx_update(data);
+
+	if (ret)
+		return ret;
+
+	vals[0] = adc_to_temp[data->temp];
+	return 0;
+}
+
 static SENSOR_DEVICE_ATTR_2(temp1_input, S_IRUGO, show_temp, NULL, 0, 0);
 static SENSOR_DEVICE_ATTR_2(temp1_input_raw, S_IRUGO, show_temp_raw,
 				NULL, 0, 0);
@@ -218,8 +245,18 @@ static int __devinit omap34xx_temp_probe(void)
 		goto exit_remove_all;
 	}
 
+	data->snapshot.name = data->name;
+	data->snapshot.channels = omap34xx_snapshot_channels;
+	data->snapshot.nchannels = ARRAY_SIZE(omap34xx_snapshot_channels);
+	data->snapshot.read = omap34xx_snapshot_read;
+	err = hwmon_snapshot_register(&data->snapshot);
+	if (err)
+		goto exit_hwmon;
+
 	return 0;
 
+exit_hwmon:
+	hwmon_device_unregister(data->hwmon_dev);
 exit_remove_all:
 	device_remove_file(&omap34xx_temp_device.dev,
 			   &dev_attr_name);
@@ -250,6 +287,7 @@ static void __exit omap34xx_temp_exit(void)
 	struct omap34xx_data *data =
 			dev_get_drvdata(&omap34xx_temp_device.dev);
 
+	hwmon_snapshot_unregister(&data->snapshot);
 	clk_put(data->clk_32k);
 	hwmon_device_unregister(data->hwmon_dev);
 	device_remove_file(&omap34xx_temp_device.dev,
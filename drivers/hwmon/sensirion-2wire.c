@@ -0,0 +1,239 @@
+/*
+ * sensirion-2wire.c - Sensirion SHTxx 2-wire bus on a pair of GPIOs
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * The SHT1x/SHT7x interface looks like I2C but is not: there are no
+ * addresses, transmission start is a sequence of its own, and the
+ * sensor signals the end of a conversion by pulling DATA low.  This
+ * file only knows the bus protocol; the sensor drivers build commands
+ * and measurement sequences on top of it.
+ *
+ * SCK is a push-pull output.  DATA is open-drain with an external
+ * pull-up: a 0 is driven, a 1 is produced by switching the GPIO to
+ * input.  All pin accesses go through gpiolib, which takes the GPIO
+ * bank lock and, on OMAP2/3, drives outputs with a single write to
+ * SETDATAOUT/CLEARDATAOUT, so several sensors (and other users of the
+ * same bank) can share a GPIO module safely.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/gpio.h>
+#include <linux/sensirion-2wire.h>
+
+static inline void sck_high(struct sensirion_2wire *bus)
+{
+	gpio_set_value(bus->sck, 1);
+	udelay(bus->udelay);
+}
+
+static inline void sck_low(struct sensirion_2wire *bus)
+{
+	gpio_set_value(bus->sck, 0);
+	udelay(bus->udelay);
+}
+
+static inline void data_low(struct sensirion_2wire *bus)
+{
+	gpio_direction_output(bus->data, 0);
+	udelay(bus->udelay);
+}
+
+/* release DATA to the pull-up */
+static inline void data_release(struct sensirion_2wire *bus)
+{
+	gpio_direction_input(bus->data);
+	udelay(bus->udelay);
+}
+
+static inline int data_get(struct sensirion_2wire *bus)
+{
+	return gpio_get_value(bus->data) ? 1 : 0;
+}
+
+/**
+ * sensirion_2wire_reset - connection reset sequence
+ * @bus: bus
+ *
+ * Toggles SCK nine or more times with DATA high (datasheet 3.4); the
+ * next command must be preceded by sensirion_2wire_start().
+ */
+void sensirion_2wire_reset(struct sensirion_2wire *bus)
+{
+	int i;
+
+	data_release(bus);
+	sck_low(bus);
+	for (i = 0; i < 9; i++) {
+		sck_high(bus);
+		sck_low(bus);
+	}
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_reset);
+
+/**
+ * sensirion_2wire_start - transmission start sequence
+ * @bus: bus
+ *
+ * DATA goes low while SCK is high, then high again during the next
+ * SCK high period (datasheet 3.2).
+ */
+void sensirion_2wire_start(struct sensirion_2wire *bus)
+{
+	data_release(bus);
+	sck_low(bus);
+	sck_high(bus);
+	data_low(bus);
+	sck_low(bus);
+	sck_high(bus);
+	data_release(bus);
+	sck_low(bus);
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_start);
+
+/**
+ * sensirion_2wire_write_byte - clock out one byte, MSB first
+ * @bus: bus
+ * @byte: value
+ *
+ * Returns 0 if the sensor acknowledged, -EIO otherwise.  DATA is
+ * released afterwards, ready for data-ready detection.
+ */
+int sensirion_2wire_write_byte(struct sensirion_2wire *bus, u8 byte)
+{
+	int i, nack;
+
+	for (i = 0; i < 8; i++, byte <<= 1) {
+		if (byte & 0x80)
+			data_release(bus);
+		else
+			data_low(bus);
+		sck_high(bus);
+		sck_low(bus);
+	}
+
+	data_release(bus);
+	sck_high(bus);
+	nack = data_get(bus);
+	sck_low(bus);
+
+	return nack ? -EIO : 0;
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_write_byte);
+
+/**
+ * sensirion_2wire_read_byte - clock in one byte, MSB first
+ * @bus: bus
+ * @ack: acknowledge the byte (more bytes follow) or not (end of frame)
+ */
+u8 sensirion_2wire_read_byte(struct sensirion_2wire *bus, int ack)
+{
+	u8 byte = 0;
+	int i;
+
+	data_release(bus);
+	for (i = 0; i < 8; i++) {
+		sck_high(bus);
+		byte = (byte << 1) | data_get(bus);
+		sck_low(bus);
+	}
+
+	if (ack)
+		data_low(bus);
+	sck_high(bus);
+	sck_low(bus);
+	data_release(bus);
+
+	return byte;
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_read_byte);
+
+/**
+ * sensirion_2wire_data_ready - has the sensor pulled DATA low?
+ * @bus: bus
+ *
+ * May be called from interrupt context.
+ */
+int sensirion_2wire_data_ready(struct sensirion_2wire *bus)
+{
+	return !data_get(bus);
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_data_ready);
+
+/**
+ * sensirion_2wire_to_irq - data-ready interrupt (falling edge on DATA)
+ * @bus: bus
+ *
+ * Returns the IRQ number, or negative errno if DATA cannot interrupt.
+ */
+int sensirion_2wire_to_irq(struct sensirion_2wire *bus)
+{
+	return gpio_to_irq(bus->data);
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_to_irq);
+
+/**
+ * sensirion_2wire_init - claim the bus GPIOs
+ * @bus: bus to initialize
+ * @pdata: GPIO assignment
+ * @label: gpiolib label
+ *
+ * Leaves SCK low and DATA released.
+ * Returns 0 on success, else negative errno.
+ */
+int sensirion_2wire_init(struct sensirion_2wire *bus,
+			 const struct sensirion_2wire_platform_data *pdata,
+			 const char *label)
+{
+	int err;
+
+	bus->sck = pdata->sck_gpio;
+	bus->data = pdata->data_gpio;
+	bus->udelay = pdata->udelay ? pdata->udelay : SENSIRION_2WIRE_UDELAY;
+
+	err = gpio_request(bus->sck, label);
+	if (err)
+		return err;
+
+	err = gpio_request(bus->data, label);
+	if (err)
+		goto err_sck;
+
+	err = gpio_direction_output(bus->sck, 0);
+	if (err)
+		goto err_data;
+
+	err = gpio_direction_input(bus->data);
+	if (err)
+		goto err_data;
+
+	return 0;
+
+err_data:
+	gpio_free(bus->data);
+err_sck:
+	gpio_free(bus->sck);
+	return err;
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_init);
+
+/**
+ * sensirion_2wire_free - release the bus GPIOs
+ * @bus: bus
+ */
+void sensirion_2wire_free(struct sensirion_2wire *bus)
+{
+	gpio_direction_input(bus->data);
+	gpio_free(bus->data);
+	gpio_free(bus->sck);
+}
+EXPORT_SYMBOL_GPL(sensirion_2wire_free);
+
+MODULE_DESCRIPTION("Sensirion SHTxx 2-wire bus on GPIOs");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,1305 @@
+/*
+ * sensirion-core.c - common core for Sensirion humidity/temperature sensors
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * The SHT1x/SHT7x (2-wire bus) and SHT2x (I2C) families share the
+ * measurement sequence, the CRC and most of the ABI; only the transport
+ * and the conversion formulas differ.  This file owns everything that
+ * is common: the measurement cycle with its retry budget, sample
+ * caching and rate limiting, conversion to milli celsius and per cent
+ * mille, the background sampler with its mmap()able sample ring and
+ * misc device, and the hwmon attributes.  Drivers for the individual
+ * sensors are thin backends providing struct sensirion_ops.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/hwmon.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+#include <linux/kobject.h>
+#include <linux/kref.h>
+#include "sensirion.h"
+
+/*
+ * Data sheets (SHT7x 3.3, SHT2x 2.4): the sensor should not be active
+ * for more than 10% of the time, so sysfs reads reuse a cycle that is
+ * younger than this.
+ */
+#define SENSIRION_MIN_UPDATE	(HZ / 2)
+
+/* smallest auto_update_interval, ms */
+#define SENSIRION_MIN_INTERVAL	100
+
+/*
+ * The sample ring.  Open files keep it, not the sensor, so it can
+ * outlive the backend: misc_deregister() doesn't close them.
+ */
+struct sensirion_stream {
+	struct kref		kref;		/* sensor + open files */
+	struct sht7x_ring	*ring;		/* vmalloc_user()ed, mmap()able */
+	struct sht7x_sample	*samples;	/* records after the ring header */
+	wait_queue_head_t	wait;		/* new records, or dead */
+	int			dead;		/* sensor unregistered */
+};
+
+/* per-open() state of the sample stream */
+struct sensirion_reader {
+	struct sensirion_stream	*stream;
+	struct mutex		lock;		/* protects tail */
+	u32			tail;		/* next record to read */
+};
+
+static LIST_HEAD(sensirion_sensors);
+static DEFINE_MUTEX(sensirion_sensors_lock);
+
+/* CRC-8, polynomial x^8 + x^5 + x^4 + 1, MSB first */
+static const u8 sensirion_crc8_table[256] = {
+	0x00, 0x31, 0x62, 0x53, 0xc4, 0xf5, 0xa6, 0x97,
+	0xb9, 0x88, 0xdb, 0xea, 0x7d, 0x4c, 0x1f, 0x2e,
+	0x43, 0x72, 0x21, 0x10, 0x87, 0xb6, 0xe5, 0xd4,
+	0xfa, 0xcb, 0x98, 0xa9, 0x3e, 0x0f, 0x5c, 0x6d,
+	0x86, 0xb7, 0xe4, 0xd5, 0x42, 0x73, 0x20, 0x11,
+	0x3f, 0x0e, 0x5d, 0x6c, 0xfb, 0xca, 0x99, 0xa8,
+	0xc5, 0xf4, 0xa7, 0x96, 0x01, 0x30, 0x63, 0x52,
+	0x7c, 0x4d, 0x1e, 0x2f, 0xb8, 0x89, 0xda, 0xeb,
+	0x3d, 0x0c, 0x5f, 0x6e, 0xf9, 0xc8, 0x9b, 0xaa,
+	0x84, 0xb5, 0xe6, 0xd7, 0x40, 0x71, 0x22, 0x13,
+	0x7e, 0x4f, 0x1c, 0x2d, 0xba, 0x8b, 0xd8, 0xe9,
+	0xc7, 0xf6, 0xa5, 0x94, 0x03, 0x32, 0x61, 0x50,
+	0xbb, 0x8a, 0xd9, 0xe8, 0x7f, 0x4e, 0x1d, 0x2c,
+	0x02, 0x33, 0x60, 0x51, 0xc6, 0xf7, 0xa4, 0x95,
+	0xf8, 0xc9, 0x9a, 0xab, 0x3c, 0x0d, 0x5e, 0x6f,
+	0x41, 0x70, 0x23, 0x12, 0x85, 0xb4, 0xe7, 0xd6,
+	0x7a, 0x4b, 0x18, 0x29, 0xbe, 0x8f, 0xdc, 0xed,
+	0xc3, 0xf2, 0xa1, 0x90, 0x07, 0x36, 0x65, 0x54,
+	0x39, 0x08, 0x5b, 0x6a, 0xfd, 0xcc, 0x9f, 0xae,
+	0x80, 0xb1, 0xe2, 0xd3, 0x44, 0x75, 0x26, 0x17,
+	0xfc, 0xcd, 0x9e, 0xaf, 0x38, 0x09, 0x5a, 0x6b,
+	0x45, 0x74, 0x27, 0x16, 0x81, 0xb0, 0xe3, 0xd2,
+	0xbf, 0x8e, 0xdd, 0xec, 0x7b, 0x4a, 0x19, 0x28,
+	0x06, 0x37, 0x64, 0x55, 0xc2, 0xf3, 0xa0, 0x91,
+	0x47, 0x76, 0x25, 0x14, 0x83, 0xb2, 0xe1, 0xd0,
+	0xfe, 0xcf, 0x9c, 0xad, 0x3a, 0x0b, 0x58, 0x69,
+	0x04, 0x35, 0x66, 0x57, 0xc0, 0xf1, 0xa2, 0x93,
+	0xbd, 0x8c, 0xdf, 0xee, 0x79, 0x48, 0x1b, 0x2a,
+	0xc1, 0xf0, 0xa3, 0x92, 0x05, 0x34, 0x67, 0x56,
+	0x78, 0x49, 0x1a, 0x2b, 0xbc, 0x8d, 0xde, 0xef,
+	0x82, 0xb3, 0xe0, 0xd1, 0x46, 0x77, 0x24, 0x15,
+	0x3b, 0x0a, 0x59, 0x68, 0xff, 0xce, 0x9d, 0xac,
+};
+
+/**
+ * sensirion_crc8 - update a Sensirion CRC-8
+ * @crc: CRC so far (initial value: see the sensor datasheet)
+ * @buf: bytes as they appeared on the bus
+ * @len: number of bytes
+ *
+ * Note that the SHT1x/SHT7x transmit the checksum bit-reversed.
+ */
+u8 sensirion_crc8(u8 crc, const u8 *buf, size_t len)
+{
+	while (len--)
+		crc = sensirion_crc8_table[crc ^ *buf++];
+
+	return crc;
+}
+EXPORT_SYMBOL_GPL(sensirion_crc8);
+
+/*********************** conversion ****************************/
+
+/*
+ * SHT7x temperature offset d1 for VDD = 3.3V, interpolated between the
+ * 3V and 3.5V values of data sheet table 8, in milli celsius.
+ */
+#define SHT7X_D1		(-39660)
+
+/**
+ * struct sht7x_coeff - SHT7x per-resolution conversion coefficients
+ * @t_mask: valid bits of a temperature reading
+ * @d2: temperature slope, milli celsius per tick
+ * @rh_mask: valid bits of a humidity reading
+ * @c2: humidity slope, 1/10000 %RH per tick
+ * @c3: quadratic humidity coefficient, 1/1000 %RH per tick^2 times @c3_div
+ * @c3_div: see @c3
+ * @t2: temperature compensation slope, 1/1000000 per tick
+ *
+ * Coefficients from SHT7x data sheet 4.1 - 4.3.
+ */
+struct sht7x_coeff {
+	int	t_mask;
+	int	d2;
+	int	rh_mask;
+	int	c2;
+	int	c3;
+	int	c3_div;
+	int	t2;
+};
+
+static const struct sht7x_coeff sht7x_coeffs[] = {
+	/* 14bit temperature, 12bit humidity (power-on default) */
+	{
+		.t_mask		= 0x3fff,
+		.d2		= 10,
+		.rh_mask	= 0x0fff,
+		.c2		= 367,
+		.c3		= 15955,
+		.c3_div		= 10000000,
+		.t2		= 80,
+	},
+	/* 12bit temperature, 8bit humidity */
+	{
+		.t_mask		= 0x0fff,
+		.d2		= 40,
+		.rh_mask	= 0x00ff,
+		.c2		= 5872,
+		.c3		= 40845,
+		.c3_div		= 100000,
+		.t2		= 1280,
+	},
+};
+
+/**
+ * sht7x_temp_ticks_to_millicelsius() - convert raw temperature ticks to
+ * milli celsius
+ * @c: coefficients for the resolution the ticks were measured at
+ * @ticks: temperature ticks value received from sensor
+ */
+static inline int sht7x_temp_ticks_to_millicelsius(
+		const struct sht7x_coeff *c, int ticks)
+{
+	/*
+	 * Formula T = d1 + d2 * SOT from data sheet 4.3
+	 */
+	return SHT7X_D1 + c->d2 * (ticks & c->t_mask);
+}
+
+/**
+ * sht7x_rh_ticks_to_per_cent_mille() - convert raw humidity ticks to
+ * one-thousandths of a percent relative humidity
+ * @c: coefficients for the resolution the ticks were measured at
+ * @ticks: humidity ticks value received from sensor
+ * @temperature: temperature of the same cycle in milli celsius
+ */
+static inline int sht7x_rh_ticks_to_per_cent_mille(
+		const struct sht7x_coeff *c, int ticks, int temperature)
+{
+	s64 sq;
+	int rh;
+
+	ticks &= c->rh_mask;
+	sq = (s64)ticks * ticks;
+	/*
+	 * Formula RHlinear = c1 + c2 * SORH + c3 * SORH^2 from data sheet
+	 * 4.1, c1 = -2.0468, temperature compensated by
+	 * RHtrue = (T - 25) * (t1 + t2 * SORH) + RHlinear from data sheet
+	 * 4.2, t1 = 0.01.  64bit intermediates keep the quadratic and
+	 * compensation terms exact to 1/1000 %RH.
+	 */
+	rh = (-20468 + c->c2 * ticks) / 10
+	     - (int)div_s64(c->c3 * sq, c->c3_div)
+	     + (int)div_s64((s64)(temperature - 25000) *
+			    (10000 + c->t2 * ticks), 1000000);
+
+	/* data sheet 4.1: values above 100% mean saturated air */
+	return clamp_val(rh, 0, 100000);
+}
+
+/**
+ * sht21_temp_ticks_to_millicelsius() - convert raw temperature ticks to
+ * milli celsius
+ * @ticks: temperature ticks value received from sensor
+ */
+static inline int sht21_temp_ticks_to_millicelsius(int ticks)
+{
+	ticks &= ~0x0003; /* clear status bits */
+	/*
+	 * Formula T = -46.85 + 175.72 * ST / 2^16 from data sheet 6.2,
+	 * optimized for integer fixed point (3 digits) arithmetic
+	 */
+	return ((21965 * ticks) >> 13) - 46850;
+}
+
+/**
+ * sht21_rh_ticks_to_per_cent_mille() - convert raw humidity ticks to
+ * one-thousandths of a percent relative humidity
+ * @ticks: humidity ticks value received from sensor
+ */
+static inline int sht21_rh_ticks_to_per_cent_mille(int ticks)
+{
+	ticks &= ~0x0003; /* clear status bits */
+	/*
+	 * Formula RH = -6 + 125 * SRH / 2^16 from data sheet 6.1,
+	 * optimized for integer fixed point (3 digits) arithmetic
+	 */
+	return ((15625 * ticks) >> 13) - 6000;
+}
+
+/* raw_t/raw_rh -> temperature/humidity */
+static void sensirion_convert(struct sensirion_sensor *sensor)
+{
+	const struct sht7x_coeff *c;
+
+	switch (sensor->family) {
+	case SENSIRION_SHT7X:
+		c = &sht7x_coeffs[sensor->resolution];
+		sensor->temperature =
+			sht7x_temp_ticks_to_millicelsius(c, sensor->raw_t);
+		sensor->humidity =
+			sht7x_rh_ticks_to_per_cent_mille(c, sensor->raw_rh,
+							 sensor->temperature);
+		break;
+	case SENSIRION_SHT2X:
+		sensor->temperature =
+			sht21_temp_ticks_to_millicelsius(sensor->raw_t);
+		sensor->humidity =
+			sht21_rh_ticks_to_per_cent_mille(sensor->raw_rh);
+		break;
+	}
+}
+
+/*********************** alarms ********************************/
+
+#define SENSIRION_ALARM_MIN(ch)	(1UL << (2 * (ch)))
+#define SENSIRION_ALARM_MAX(ch)	(1UL << (2 * (ch) + 1))
+
+/* indexed by alarm bit */
+static const char * const sensirion_alarm_names[] = {
+	"temp1_min_alarm",
+	"temp1_max_alarm",
+	"humidity1_min_alarm",
+	"humidity1_max_alarm",
+};
+
+/* power-on limits, outside of what the conversions can return */
+static const struct sensirion_limits sensirion_default_limits[] = {
+	[SENSIRION_T] = {
+		.min		= -50000,
+		.min_hyst	= -50000,
+		.max		= 150000,
+		.max_hyst	= 150000,
+	},
+	[SENSIRION_RH] = {
+		.min		= 0,
+		.min_hyst	= 0,
+		.max		= 100000,
+		.max_hyst	= 100000,
+	},
+};
+
+/**
+ * sensirion_check_alarms - evaluate the limits against the cached values
+ * @sensor: sensor, lock not held
+ *
+ * Called after every completed cycle and after limit changes.  Each
+ * alarm that changes state is signalled with sysfs_notify() on its
+ * attribute, so userspace can sleep in poll() on it, and with a change
+ * uevent carrying ALARM=<attribute> and STATE=<0|1>.
+ */
+static void sensirion_check_alarms(struct sensirion_sensor *sensor)
+{
+	struct kobject *kobj = &sensor->dev->kobj;
+	unsigned long changed;
+	int val[SENSIRION_CHANNELS];
+	int ch, bit;
+
+	mutex_lock(&sensor->lock);
+	if (!sensor->valid || sensor->status) {
+		mutex_unlock(&sensor->lock);
+		return;
+	}
+
+	val[SENSIRION_T] = sensor->temperature;
+	val[SENSIRION_RH] = sensor->humidity;
+	changed = sensor->alarms;
+
+	for (ch = 0; ch < SENSIRION_CHANNELS; ch++) {
+		const struct sensirion_limits *l = &sensor->limits[ch];
+
+		if (val[ch] < l->min)
+			sensor->alarms |= SENSIRION_ALARM_MIN(ch);
+		else if (val[ch] > l->min_hyst)
+			sensor->alarms &= ~SENSIRION_ALARM_MIN(ch);
+
+		if (val[ch] > l->max)
+			sensor->alarms |= SENSIRION_ALARM_MAX(ch);
+		else if (val[ch] < l->max_hyst)
+			sensor->alarms &= ~SENSIRION_ALARM_MAX(ch);
+	}
+
+	changed ^= sensor->alarms;
+	mutex_unlock(&sensor->lock);
+
+	for (bit = 0; bit < ARRAY_SIZE(sensirion_alarm_names); bit++) {
+		char alarm[32], state[8];
+		char *envp[] = { alarm, state, NULL };
+
+		if (!(changed & (1UL << bit)))
+			continue;
+
+		sysfs_notify(kobj, NULL, sensirion_alarm_names[bit]);
+
+		snprintf(alarm, sizeof(alarm), "ALARM=%s",
+			 sensirion_alarm_names[bit]);
+		snprintf(state, sizeof(state), "STATE=%d",
+			 test_bit(bit, &sensor->alarms));
+		kobject_uevent_env(kobj, KOBJ_CHANGE, envp);
+	}
+}
+
+/*********************** measurement cycle *********************/
+
+/**
+ * sensirion_data_ready - end the current conversion
+ * @sensor: sensor
+ * @status: 0 if the result can be read, else negative errno
+ *
+ * Called by the backend exactly once per successful ->start(), from
+ * any context.
+ */
+void sensirion_data_ready(struct sensirion_sensor *sensor, int status)
+{
+	sensor->status = status;
+	queue_work(sensor->wq, &sensor->work);
+}
+EXPORT_SYMBOL_GPL(sensirion_data_ready);
+
+/* start the conversion for the current state */
+static void sensirion_issue(struct sensirion_sensor *sensor)
+{
+	int err;
+
+	err = sensor->ops->start(sensor, sensor->state == SENSIRION_MEASURE_T ?
+				 SENSIRION_T : SENSIRION_RH);
+	if (err)
+		sensirion_data_ready(sensor, err);
+}
+
+/**
+ * sensirion_push_sample - publish the completed cycle in the sample ring
+ * @sensor: sensor
+ *
+ * sensirion_work() is the only producer, so no lock is needed against
+ * other writers; readers never block the producer and detect being
+ * overrun by re-checking ring->head (see include/linux/sht7x.h).
+ */
+static void sensirion_push_sample(struct sensirion_sensor *sensor)
+{
+	struct sensirion_stream *stream = sensor->stream;
+	struct sht7x_ring *ring = stream->ring;
+	u32 head = ring->head;
+	struct sht7x_sample *sample =
+			&stream->samples[head & (ring->slots - 1)];
+
+	sample->timestamp = ktime_to_ns(sensor->stamp);
+	sample->temperature = sensor->temperature;
+	sample->humidity = sensor->humidity;
+	sample->raw_t = sensor->raw_t;
+	sample->raw_rh = sensor->raw_rh;
+	sample->status = sensor->status;
+
+	smp_wmb();
+	ring->head = head + 1;
+
+	wake_up_interruptible(&stream->wait);
+}
+
+/**
+ * sensirion_work - advance the measurement state machine
+ * @work: work_struct embedded in sensirion_sensor
+ *
+ * Runs once to start a cycle and once per finished conversion: reads
+ * the result, then either retries the conversion, starts the humidity
+ * conversion or completes the cycle.  Failed conversions are retried
+ * after ->recover() while the cycle's retry budget lasts.  The
+ * backend's ->start() and ->read() always run here, on the sensor's
+ * own thread, so neither sysfs readers nor the sampler ever wait for
+ * bus I/O while holding the lock.
+ */
+static void sensirion_work(struct work_struct *work)
+{
+	struct sensirion_sensor *sensor =
+			container_of(work, struct sensirion_sensor, work);
+	enum sensirion_channel channel;
+	u16 ticks = 0;
+
+	if (sensor->issue) {
+		sensor->issue = 0;
+		sensirion_issue(sensor);
+		return;
+	}
+
+	channel = sensor->state == SENSIRION_MEASURE_T ?
+		  SENSIRION_T : SENSIRION_RH;
+	if (!sensor->status)
+		sensor->status = sensor->ops->read(sensor, channel, &ticks);
+
+	if (sensor->status && sensor->retry_budget > 0) {
+		sensor->retry_budget--;
+		sensor->retries++;
+		if (sensor->ops->recover)
+			sensor->ops->recover(sensor);
+		sensirion_issue(sensor);
+		return;
+	}
+
+	if (sensor->state == SENSIRION_MEASURE_T && !sensor->status) {
+		sensor->raw_t = ticks;
+		sensor->state = SENSIRION_MEASURE_RH;
+		sensirion_issue(sensor);
+		return;
+	}
+
+	if (sensor->status && sensor->ops->recover)
+		sensor->ops->recover(sensor);
+
+	mutex_lock(&sensor->lock);
+	if (!sensor->status) {
+		sensor->raw_rh = ticks;
+		sensirion_convert(sensor);
+	} else {
+		sensor->raw_t       = 0;
+		sensor->raw_rh      = 0;
+		sensor->temperature = 0;
+		sensor->humidity    = 0;
+	}
+	sensor->last_updated = jiffies;
+	sensor->valid = 1;
+	sensor->state = SENSIRION_IDLE;
+	sensirion_push_sample(sensor);
+	mutex_unlock(&sensor->lock);
+
+	wake_up_all(&sensor->wait);
+
+	sensirion_check_alarms(sensor);
+
+	/* unless the next cycle has already started */
+	mutex_lock(&sensor->lock);
+	if (sensor->state == SENSIRION_IDLE)
+		wake_unlock(&sensor->wake_lock);
+	mutex_unlock(&sensor->lock);
+}
+
+/**
+ * sensirion_lock_idle - take the sensor lock with no cycle in flight
+ * @sensor: sensor
+ *
+ * Backends use this around transactions of their own (status
+ * registers and the like).
+ * Returns 0 with sensor->lock held, or -ERESTARTSYS.
+ */
+int sensirion_lock_idle(struct sensirion_sensor *sensor)
+{
+	for (;;) {
+		mutex_lock(&sensor->lock);
+		if (sensor->state == SENSIRION_IDLE)
+			return 0;
+		mutex_unlock(&sensor->lock);
+
+		if (wait_event_interruptible(sensor->wait,
+					     sensor->state == SENSIRION_IDLE))
+			return -ERESTARTSYS;
+	}
+}
+EXPORT_SYMBOL_GPL(sensirion_lock_idle);
+
+/**
+ * sensirion_suspend - refuse to suspend in the middle of a cycle
+ * @sensor: sensor
+ *
+ * For the backend's suspend method.  The cycle's wake lock normally
+ * keeps the system up; this catches suspends forced past it, which
+ * would otherwise cut a bus transaction short.
+ * Returns 0, or -EBUSY.
+ */
+int sensirion_suspend(struct sensirion_sensor *sensor)
+{
+	return sensor->state == SENSIRION_IDLE ? 0 : -EBUSY;
+}
+EXPORT_SYMBOL_GPL(sensirion_suspend);
+
+/**
+ * sensirion_start_cycle - start a measurement cycle unless one is running
+ * @sensor: sensor, lock held
+ *
+ * The system stays awake until the cycle completes.
+ */
+static void sensirion_start_cycle(struct sensirion_sensor *sensor)
+{
+	if (sensor->state != SENSIRION_IDLE)
+		return;
+
+	wake_lock(&sensor->wake_lock);
+	sensor->stamp = ktime_get();
+	sensor->retry_budget = SENSIRION_RETRIES;
+	sensor->state = SENSIRION_MEASURE_T;
+	sensor->issue = 1;
+	queue_work(sensor->wq, &sensor->work);
+}
+
+/* start a measurement cycle if the cached one is stale */
+static void sensirion_refresh(struct sensirion_sensor *sensor)
+{
+	mutex_lock(&sensor->lock);
+	if (time_after(jiffies, sensor->last_updated + SENSIRION_MIN_UPDATE) ||
+	    !sensor->valid)
+		sensirion_start_cycle(sensor);
+	mutex_unlock(&sensor->lock);
+}
+
+/**
+ * sensirion_update - refresh the cached measurement if it is stale
+ * @sensor: sensor
+ *
+ * Starts a measurement cycle unless one is already running, then
+ * sleeps until it completes so the CPU may idle during conversion.
+ *
+ * Returns 0 on success, else negative errno.
+ */
+static int sensirion_update(struct sensirion_sensor *sensor)
+{
+	int ret;
+
+	sensirion_refresh(sensor);
+
+	ret = wait_event_interruptible(sensor->wait,
+				       sensor->state == SENSIRION_IDLE);
+	if (ret)
+		return ret;
+
+	return sensor->status;
+}
+
+static enum hrtimer_restart sensirion_sample_timer(struct hrtimer *timer)
+{
+	struct sensirion_sensor *sensor =
+			container_of(timer, struct sensirion_sensor,
+				     sample_timer);
+
+	wake_up_process(sensor->sampler);
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart sensirion_wall_timer(struct hrtimer *timer)
+{
+	struct sensirion_sensor *sensor =
+			container_of(timer, struct sensirion_sensor,
+				     wall_timer);
+
+	wake_up_process(sensor->sampler);
+	return HRTIMER_NORESTART;
+}
+
+/* CLOCK_MONOTONIC plus the time spent suspended */
+static void sensirion_elapsed(struct timespec *ts)
+{
+	ktime_get_ts(ts);
+	monotonic_to_bootbased(ts);
+}
+
+/**
+ * sensirion_sample_sleep - sleep until the next sample is due
+ * @sensor: sensor
+ * @delta: elapsed time to the next sample, ns
+ *
+ * The CLOCK_MONOTONIC timer does not care about clock steps but stops
+ * in suspend.  The wall clock is only used to carry the deadline across
+ * a suspend, by the rtc wakeup and a CLOCK_REALTIME timer, which fires
+ * as soon as the system has resumed.  Either may wake us early, and the
+ * caller checks the elapsed time again.
+ */
+static void sensirion_sample_sleep(struct sensirion_sensor *sensor,
+				   s64 delta)
+{
+	struct timespec wall;
+
+	getnstimeofday(&wall);
+	timespec_add_ns(&wall, delta);
+	android_alarm_wakeup_set(&sensor->wakeup, wall);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	hrtimer_start(&sensor->sample_timer, ns_to_ktime(delta),
+		      HRTIMER_MODE_REL);
+	hrtimer_start(&sensor->wall_timer, timespec_to_ktime(wall),
+		      HRTIMER_MODE_ABS);
+	if (!kthread_should_stop())
+		schedule();
+	__set_current_state(TASK_RUNNING);
+	hrtimer_cancel(&sensor->sample_timer);
+	hrtimer_cancel(&sensor->wall_timer);
+}
+
+/**
+ * sensirion_sampler - background sampling thread
+ * @arg: sensor
+ *
+ * Runs a measurement cycle every auto_update_interval ms, feeding the
+ * sample ring; sleeps while the interval is 0.
+ *
+ * The cadence is kept on the monotonic clock plus the time spent
+ * suspended, which neither stops in suspend like jiffies nor steps
+ * with settimeofday() or NTP like CLOCK_REALTIME.  Every deadline is
+ * also armed as an rtc wakeup, so the system may suspend between
+ * samples: the rtc resumes it in time and the cycle's wake lock holds
+ * it up for the conversion only.  Samples taken while userspace is
+ * frozen wait in the ring.
+ */
+static int sensirion_sampler(void *arg)
+{
+	struct sensirion_sensor *sensor = arg;
+	struct timespec next, now;
+	s64 period, delta;
+
+	sensirion_elapsed(&next);
+
+	while (!kthread_should_stop()) {
+		unsigned int interval = sensor->interval;
+
+		if (!interval) {
+			android_alarm_wakeup_cancel(&sensor->wakeup);
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!kthread_should_stop() && !sensor->interval)
+				schedule();
+			__set_current_state(TASK_RUNNING);
+			sensirion_elapsed(&next);
+			continue;
+		}
+		period = (s64)interval * NSEC_PER_MSEC;
+
+		/* woken early, or the interval was shortened meanwhile */
+		sensirion_elapsed(&now);
+		delta = timespec_to_ns(&next) - timespec_to_ns(&now);
+		if (delta > period) {
+			next = now;
+			timespec_add_ns(&next, period);
+			delta = period;
+		}
+		if (delta > 0) {
+			sensirion_sample_sleep(sensor, delta);
+			continue;
+		}
+
+		mutex_lock(&sensor->lock);
+		sensirion_start_cycle(sensor);
+		mutex_unlock(&sensor->lock);
+
+		/* bounded by the backend's conversion timeouts */
+		wait_event(sensor->wait, sensor->state == SENSIRION_IDLE);
+
+		timespec_add_ns(&next, period);
+		sensirion_elapsed(&now);
+		if (timespec_compare(&next, &now) < 0)
+			next = now;
+	}
+
+	android_alarm_wakeup_cancel(&sensor->wakeup);
+	return 0;
+}
+
+/*********************** sample stream *************************/
+
+static void sensirion_stream_release(struct kref *kref)
+{
+	struct sensirion_stream *stream =
+		container_of(kref, struct sensirion_stream, kref);
+
+	vfree(stream->ring);
+	kfree(stream);
+}
+
+static void sensirion_stream_put(struct sensirion_stream *stream)
+{
+	kref_put(&stream->kref, sensirion_stream_release);
+}
+
+/* the sensor is going away, readers get -ENODEV from now on */
+static void sensirion_stream_kill(struct sensirion_stream *stream)
+{
+	stream->dead = 1;
+	wake_up_interruptible_all(&stream->wait);
+}
+
+static int sensirion_open(struct inode *inode, struct file *file)
+{
+	struct sensirion_sensor *sensor;
+	struct sensirion_stream *stream;
+	struct sensirion_reader *reader;
+	int minor = iminor(inode);
+	u32 head;
+
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	mutex_lock(&sensirion_sensors_lock);
+	list_for_each_entry(sensor, &sensirion_sensors, list)
+		if (sensor->miscdev.minor == minor)
+			goto found;
+	mutex_unlock(&sensirion_sensors_lock);
+	kfree(reader);
+	return -ENODEV;
+
+found:
+	/* the list lock keeps the sensor from being unregistered */
+	stream = sensor->stream;
+	kref_get(&stream->kref);
+	mutex_unlock(&sensirion_sensors_lock);
+
+	reader->stream = stream;
+	mutex_init(&reader->lock);
+	/* start with whatever backlog is still intact */
+	head = ACCESS_ONCE(stream->ring->head);
+	reader->tail = head - min(head, stream->ring->slots - 1);
+	file->private_data = reader;
+
+	return nonseekable_open(inode, file);
+}
+
+static int sensirion_release(struct inode *inode, struct file *file)
+{
+	struct sensirion_reader *reader = file->private_data;
+
+	sensirion_stream_put(reader->stream);
+	kfree(reader);
+	return 0;
+}
+
+/**
+ * sensirion_read - copy as many whole samples as fit into @buf
+ *
+ * Blocks until at least one sample is available unless O_NONBLOCK.
+ * Samples that were overwritten before they could be read are skipped.
+ */
+static ssize_t sensirion_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *pos)
+{
+	struct sensirion_reader *reader = file->private_data;
+	struct sensirion_stream *stream = reader->stream;
+	struct sht7x_ring *ring = stream->ring;
+	struct sht7x_sample sample;
+	size_t done = 0;
+	u32 head, tail;
+	int ret;
+
+	if (count < sizeof(sample))
+		return -EINVAL;
+
+	mutex_lock(&reader->lock);
+
+	while (ACCESS_ONCE(ring->head) == reader->tail) {
+		/* drained, and no more samples are coming */
+		ret = ACCESS_ONCE(stream->dead);
+		mutex_unlock(&reader->lock);
+		if (ret)
+			return -ENODEV;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(stream->wait,
+				ACCESS_ONCE(ring->head) != reader->tail ||
+				ACCESS_ONCE(stream->dead));
+		if (ret)
+			return ret;
+		mutex_lock(&reader->lock);
+	}
+
+	head = ACCESS_ONCE(ring->head);
+	tail = reader->tail;
+	while (tail != head && done + sizeof(sample) <= count) {
+		smp_rmb();
+		sample = stream->samples[tail & (ring->slots - 1)];
+		smp_rmb();
+		head = ACCESS_ONCE(ring->head);
+		if (head - tail >= ring->slots) {
+			/* overrun: the slot may have been recycled */
+			tail = head - (ring->slots - 1);
+			continue;
+		}
+		if (copy_to_user(buf + done, &sample, sizeof(sample))) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+		done += sizeof(sample);
+		tail++;
+	}
+	reader->tail = tail;
+
+	mutex_unlock(&reader->lock);
+
+	return done;
+}
+
+static unsigned int sensirion_poll(struct file *file, poll_table *wait)
+{
+	struct sensirion_reader *reader = file->private_data;
+	struct sensirion_stream *stream = reader->stream;
+
+	poll_wait(file, &stream->wait, wait);
+
+	if (ACCESS_ONCE(stream->ring->head) != reader->tail)
+		return POLLIN | POLLRDNORM;
+	if (ACCESS_ONCE(stream->dead))
+		return POLLERR | POLLHUP;
+
+	return 0;
+}
+
+/* read-only view of struct sht7x_ring followed by the sample records */
+static int sensirion_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct sensirion_reader *reader = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, reader->stream->ring, vma->vm_pgoff);
+}
+
+static const struct file_operations sensirion_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sensirion_open,
+	.release	= sensirion_release,
+	.read		= sensirion_read,
+	.poll		= sensirion_poll,
+	.mmap		= sensirion_mmap,
+	.llseek		= no_llseek,
+};
+
+/**
+ * sensirion_ring_alloc - allocate the mmap()able sample ring
+ * @sensor: sensor
+ *
+ * The sensor holds the first reference to the stream.
+ * Returns 0 on success, else negative errno.
+ */
+static int sensirion_ring_alloc(struct sensirion_sensor *sensor)
+{
+	unsigned long offset = PAGE_ALIGN(sizeof(struct sht7x_ring));
+	struct sensirion_stream *stream;
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (!stream)
+		return -ENOMEM;
+
+	stream->ring = vmalloc_user(offset +
+			SHT7X_RING_SLOTS * sizeof(struct sht7x_sample));
+	if (!stream->ring) {
+		kfree(stream);
+		return -ENOMEM;
+	}
+
+	stream->ring->slots = SHT7X_RING_SLOTS;
+	stream->ring->offset = offset;
+	stream->ring->sample_size = sizeof(struct sht7x_sample);
+	stream->samples = (void *)stream->ring + offset;
+	init_waitqueue_head(&stream->wait);
+	kref_init(&stream->kref);
+	sensor->stream = stream;
+
+	return 0;
+}
+
+/*********************** sysfs *********************************/
+
+static ssize_t show_name(struct device *dev,
+			 struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%s\n", sensor->name);
+}
+
+static ssize_t show_temp(struct device *dev,
+			 struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	int ret = sensirion_update(sensor);
+
+	if (ret < 0)
+		return ret;
+
+	return sprintf(buf, "%d\n", sensor->temperature);
+}
+
+static ssize_t show_humidity(struct device *dev,
+			     struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	int ret = sensirion_update(sensor);
+
+	if (ret < 0)
+		return ret;
+
+	return sprintf(buf, "%d\n", sensor->humidity);
+}
+
+static ssize_t show_auto_update_interval(struct device *dev,
+			struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", sensor->interval);
+}
+
+/**
+ * set_auto_update_interval - set the background sampling period in ms
+ * @dev: hwmon device of the sensor
+ * @devattr: the auto_update_interval attribute
+ * @buf: interval in ms, 0 stops background sampling
+ * @count: length of @buf
+ *
+ * Returns @count on success, else negative errno.
+ */
+static ssize_t set_auto_update_interval(struct device *dev,
+			struct device_attribute *devattr,
+			const char *buf, size_t count)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	if (val && val < SENSIRION_MIN_INTERVAL)
+		return -EINVAL;
+
+	sensor->interval = val;
+	wake_up_process(sensor->sampler);
+
+	return count;
+}
+
+/**
+ * show_counter - show one of the error counters
+ * @dev: hwmon device of the sensor
+ * @devattr: index is the offset of the counter in struct sensirion_sensor
+ * @buf: page to print the counter to
+ *
+ * Returns the number of bytes written to @buf.
+ */
+static ssize_t show_counter(struct device *dev,
+			    struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	int offset = to_sensor_dev_attr(devattr)->index;
+
+	return sprintf(buf, "%lu\n",
+		       *(unsigned long *)((char *)sensor + offset));
+}
+
+/* nr is the channel, index selects the member of struct sensirion_limits */
+enum {
+	SENSIRION_LIMIT_MIN,
+	SENSIRION_LIMIT_MIN_HYST,
+	SENSIRION_LIMIT_MAX,
+	SENSIRION_LIMIT_MAX_HYST,
+};
+
+static int *sensirion_limit(struct sensirion_sensor *sensor,
+			    struct sensor_device_attribute_2 *attr)
+{
+	struct sensirion_limits *l = &sensor->limits[attr->nr];
+
+	switch (attr->index) {
+	case SENSIRION_LIMIT_MIN:
+		return &l->min;
+	case SENSIRION_LIMIT_MIN_HYST:
+		return &l->min_hyst;
+	case SENSIRION_LIMIT_MAX:
+		return &l->max;
+	default:
+		return &l->max_hyst;
+	}
+}
+
+static ssize_t show_limit(struct device *dev,
+			  struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n",
+		       *sensirion_limit(sensor, to_sensor_dev_attr_2(devattr)));
+}
+
+/**
+ * set_limit - change an alarm threshold
+ * @dev: hwmon device of the sensor
+ * @devattr: nr is the channel, index the threshold
+ * @buf: value in the unit of the channel's _input attribute
+ * @count: length of @buf
+ *
+ * The new threshold is applied to the cached values right away.
+ * Returns @count on success, else negative errno.
+ */
+static ssize_t set_limit(struct device *dev,
+			 struct device_attribute *devattr,
+			 const char *buf, size_t count)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	long val;
+
+	if (strict_strtol(buf, 10, &val))
+		return -EINVAL;
+
+	mutex_lock(&sensor->lock);
+	*sensirion_limit(sensor, to_sensor_dev_attr_2(devattr)) = val;
+	mutex_unlock(&sensor->lock);
+
+	sensirion_check_alarms(sensor);
+
+	return count;
+}
+
+static ssize_t show_alarm(struct device *dev,
+			  struct device_attribute *devattr, char *buf)
+{
+	struct sensirion_sensor *sensor = dev_get_drvdata(dev);
+	int bit = to_sensor_dev_attr(devattr)->index;
+
+	return sprintf(buf, "%d\n", test_bit(bit, &sensor->alarms));
+}
+
+#define SENSIRION_LIMIT_ATTRS(_name, _ch)				\
+static SENSOR_DEVICE_ATTR_2(_name##_min, S_IWUSR | S_IRUGO,		\
+	show_limit, set_limit, _ch, SENSIRION_LIMIT_MIN);		\
+static SENSOR_DEVICE_ATTR_2(_name##_min_hyst, S_IWUSR | S_IRUGO,	\
+	show_limit, set_limit, _ch, SENSIRION_LIMIT_MIN_HYST);		\
+static SENSOR_DEVICE_ATTR_2(_name##_max, S_IWUSR | S_IRUGO,		\
+	show_limit, set_limit, _ch, SENSIRION_LIMIT_MAX);		\
+static SENSOR_DEVICE_ATTR_2(_name##_max_hyst, S_IWUSR | S_IRUGO,	\
+	show_limit, set_limit, _ch, SENSIRION_LIMIT_MAX_HYST);		\
+static SENSOR_DEVICE_ATTR(_name##_min_alarm, S_IRUGO, show_alarm, NULL,	\
+	2 * (_ch));							\
+static SENSOR_DEVICE_ATTR(_name##_max_alarm, S_IRUGO, show_alarm, NULL,	\
+	2 * (_ch) + 1)
+
+#define SENSIRION_LIMIT_ATTR_LIST(_name)				\
+	&sensor_dev_attr_##_name##_min.dev_attr.attr,			\
+	&sensor_dev_attr_##_name##_min_hyst.dev_attr.attr,		\
+	&sensor_dev_attr_##_name##_max.dev_attr.attr,			\
+	&sensor_dev_attr_##_name##_max_hyst.dev_attr.attr,		\
+	&sensor_dev_attr_##_name##_min_alarm.dev_attr.attr,		\
+	&sensor_dev_attr_##_name##_max_alarm.dev_attr.attr
+
+static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, show_temp, NULL, 0);
+static SENSOR_DEVICE_ATTR(humidity1_input, S_IRUGO, show_humidity, NULL, 0);
+SENSIRION_LIMIT_ATTRS(temp1, SENSIRION_T);
+SENSIRION_LIMIT_ATTRS(humidity1, SENSIRION_RH);
+static DEVICE_ATTR(name, S_IRUGO, show_name, NULL);
+static DEVICE_ATTR(auto_update_interval, S_IWUSR | S_IRUGO,
+		   show_auto_update_interval, set_auto_update_interval);
+static SENSOR_DEVICE_ATTR(crc_errors, S_IRUGO, show_counter, NULL,
+			  offsetof(struct sensirion_sensor, crc_errors));
+static SENSOR_DEVICE_ATTR(retries, S_IRUGO, show_counter, NULL,
+			  offsetof(struct sensirion_sensor, retries));
+
+static struct attribute *sensirion_attributes[] = {
+	&sensor_dev_attr_temp1_input.dev_attr.attr,
+	&sensor_dev_attr_humidity1_input.dev_attr.attr,
+	&dev_attr_name.attr,
+	&dev_attr_auto_update_interval.attr,
+	&sensor_dev_attr_crc_errors.dev_attr.attr,
+	&sensor_dev_attr_retries.dev_attr.attr,
+	SENSIRION_LIMIT_ATTR_LIST(temp1),
+	SENSIRION_LIMIT_ATTR_LIST(humidity1),
+	NULL
+};
+
+static const struct attribute_group sensirion_attr_group = {
+	.attrs = sensirion_attributes,
+};
+
+/*********************** snapshot ******************************/
+
+static const char * const sensirion_snapshot_channels[] = {
+	"temp1",
+	"humidity1",
+};
+
+/* kick off the cycle that sensirion_snapshot_read() will collect */
+static void sensirion_snapshot_prepare(struct hwmon_snapshot_source *src)
+{
+	sensirion_refresh(container_of(src, struct sensirion_sensor, snapshot));
+}
+
+/* newest cycle, as started by sensirion_snapshot_prepare() */
+static int sensirion_snapshot_read(struct hwmon_snapshot_source *src,
+				   s32 *vals)
+{
+	struct sensirion_sensor *sensor =
+			container_of(src, struct sensirion_sensor, snapshot);
+	int ret = sensirion_update(sensor);
+
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&sensor->lock);
+	vals[0] = sensor->temperature;
+	vals[1] = sensor->humidity;
+	mutex_unlock(&sensor->lock);
+
+	return 0;
+}
+
+/*********************** registration **************************/
+
+/**
+ * sensirion_register - register a sensor with hwmon and the sample stream
+ * @sensor: sensor, backend fields filled in, the rest zeroed
+ *
+ * Sets the driver data of sensor->dev to @sensor.  The backend must be
+ * ready to start conversions when this is called.
+ * Returns 0 on success, else negative errno.
+ */
+int sensirion_register(struct sensirion_sensor *sensor)
+{
+	struct device *dev = sensor->dev;
+	int err;
+
+	mutex_init(&sensor->lock);
+	init_waitqueue_head(&sensor->wait);
+	INIT_WORK(&sensor->work, sensirion_work);
+	sensor->state = SENSIRION_IDLE;
+	sensor->last_updated = jiffies;
+	memcpy(sensor->limits, sensirion_default_limits,
+	       sizeof(sensor->limits));
+	wake_lock_init(&sensor->wake_lock, WAKE_LOCK_SUSPEND, sensor->devname);
+	hrtimer_init(&sensor->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sensor->sample_timer.function = sensirion_sample_timer;
+	hrtimer_init(&sensor->wall_timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	sensor->wall_timer.function = sensirion_wall_timer;
+	android_alarm_wakeup_init(&sensor->wakeup);
+	dev_set_drvdata(dev, sensor);
+
+	/* conversions may block on the bus, keep them off keventd */
+	sensor->wq = create_singlethread_workqueue(sensor->devname);
+	if (!sensor->wq) {
+		err = -ENOMEM;
+		goto exit_drvdata;
+	}
+
+	err = sensirion_ring_alloc(sensor);
+	if (err)
+		goto exit_wq;
+
+	err = sysfs_create_group(&dev->kobj, &sensirion_attr_group);
+	if (err)
+		goto exit_ring;
+
+	if (sensor->attrs) {
+		err = sysfs_create_group(&dev->kobj, sensor->attrs);
+		if (err)
+			goto exit_remove;
+	}
+
+	sensor->hwmon_dev = hwmon_device_register(dev);
+	if (IS_ERR(sensor->hwmon_dev)) {
+		err = PTR_ERR(sensor->hwmon_dev);
+		goto exit_remove_attrs;
+	}
+
+	sensor->sampler = kthread_run(sensirion_sampler, sensor, "%s",
+				      sensor->devname);
+	if (IS_ERR(sensor->sampler)) {
+		err = PTR_ERR(sensor->sampler);
+		goto exit_hwmon;
+	}
+
+	sensor->miscdev.minor = MISC_DYNAMIC_MINOR;
+	sensor->miscdev.name = sensor->devname;
+	sensor->miscdev.fops = &sensirion_fops;
+	sensor->miscdev.parent = dev;
+	mutex_lock(&sensirion_sensors_lock);
+	err = misc_register(&sensor->miscdev);
+	if (!err)
+		list_add_tail(&sensor->list, &sensirion_sensors);
+	mutex_unlock(&sensirion_sensors_lock);
+	if (err)
+		goto exit_sampler;
+
+	sensor->snapshot.name = sensor->devname;
+	sensor->snapshot.channels = sensirion_snapshot_channels;
+	sensor->snapshot.nchannels = ARRAY_SIZE(sensirion_snapshot_channels);
+	sensor->snapshot.prepare = sensirion_snapshot_prepare;
+	sensor->snapshot.read = sensirion_snapshot_read;
+	err = hwmon_snapshot_register(&sensor->snapshot);
+	if (err)
+		goto exit_misc;
+
+	return 0;
+
+exit_misc:
+	mutex_lock(&sensirion_sensors_lock);
+	list_del(&sensor->list);
+	misc_deregister(&sensor->miscdev);
+	mutex_unlock(&sensirion_sensors_lock);
+exit_sampler:
+	kthread_stop(sensor->sampler);
+exit_hwmon:
+	hwmon_device_unregister(sensor->hwmon_dev);
+exit_remove_attrs:
+	if (sensor->attrs)
+		sysfs_remove_group(&dev->kobj, sensor->attrs);
+exit_remove:
+	sysfs_remove_group(&dev->kobj, &sensirion_attr_group);
+exit_ring:
+	sensirion_stream_put(sensor->stream);
+exit_wq:
+	destroy_workqueue(sensor->wq);
+exit_drvdata:
+	dev_set_drvdata(dev, NULL);
+	wake_lock_destroy(&sensor->wake_lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(sensirion_register);
+
+/**
+ * sensirion_unregister - undo sensirion_register()
+ * @sensor: sensor
+ *
+ * Waits for a running cycle to finish; afterwards the core calls no
+ * more backend operations.
+ */
+void sensirion_unregister(struct sensirion_sensor *sensor)
+{
+	struct device *dev = sensor->dev;
+
+	hwmon_snapshot_unregister(&sensor->snapshot);
+
+	mutex_lock(&sensirion_sensors_lock);
+	list_del(&sensor->list);
+	misc_deregister(&sensor->miscdev);
+	mutex_unlock(&sensirion_sensors_lock);
+	sensirion_stream_kill(sensor->stream);
+	kthread_stop(sensor->sampler);
+
+	hwmon_device_unregister(sensor->hwmon_dev);
+	if (sensor->attrs)
+		sysfs_remove_group(&dev->kobj, sensor->attrs);
+	sysfs_remove_group(&dev->kobj, &sensirion_attr_group);
+
+	/* let a running cycle finish before the backend goes away */
+	wait_event(sensor->wait, sensor->state == SENSIRION_IDLE);
+	destroy_workqueue(sensor->wq);
+	/* files still open keep the ring until they are closed */
+	sensirion_stream_put(sensor->stream);
+	sensor->stream = NULL;
+	dev_set_drvdata(dev, NULL);
+	wake_lock_destroy(&sensor->wake_lock);
+}
+EXPORT_SYMBOL_GPL(sensirion_unregister);
+
+MODULE_DESCRIPTION("Sensirion humidity and temperature sensor core");
+MODULE_LICENSE("GPL");
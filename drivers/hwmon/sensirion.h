@@ -0,0 +1,175 @@
+/*
+ * sensirion.h - common core for Sensirion humidity/temperature sensors
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#ifndef _SENSIRION_H
+#define _SENSIRION_H
+
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/sysfs.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/wakelock.h>
+#include <linux/android_alarm.h>
+#include <linux/hwmon-snapshot.h>
+#include <linux/sht7x.h>
+
+enum sensirion_family {
+	SENSIRION_SHT7X,	/* SHT1x/SHT7x, 2-wire bus */
+	SENSIRION_SHT2X,	/* SHT2x, I2C */
+};
+
+enum sensirion_channel {
+	SENSIRION_T,
+	SENSIRION_RH,
+	SENSIRION_CHANNELS,
+};
+
+/**
+ * struct sensirion_limits - alarm thresholds of one channel
+ * @min: low alarm is raised below this
+ * @min_hyst: low alarm is cleared above this
+ * @max: high alarm is raised above this
+ * @max_hyst: high alarm is cleared below this
+ *
+ * All in the unit of the channel's _input attribute, hysteresis values
+ * absolute as in the hwmon sysfs ABI.
+ */
+struct sensirion_limits {
+	int	min;
+	int	min_hyst;
+	int	max;
+	int	max_hyst;
+};
+
+/*
+ * Measurement cycle: SENSIRION_MEASURE_T followed by SENSIRION_MEASURE_RH.
+ * In both states the sensor is converting until the backend reports the
+ * end of the conversion with sensirion_data_ready().
+ */
+enum sensirion_state {
+	SENSIRION_IDLE,
+	SENSIRION_MEASURE_T,
+	SENSIRION_MEASURE_RH,
+};
+
+/* failed conversions retried per measurement cycle before giving up */
+#define SENSIRION_RETRIES	3
+
+struct sensirion_sensor;
+struct sensirion_stream;
+
+/**
+ * struct sensirion_ops - transport backend
+ * @start: start a conversion of @channel.  The end of the conversion is
+ *	reported with sensirion_data_ready(), which may happen before
+ *	@start returns.  Returns 0, or negative errno if no conversion
+ *	was started.
+ * @read: fetch (and check) the result of the finished conversion
+ * @recover: optional, bring the interface back into a known state
+ *	after a failed conversion
+ *
+ * All three are called in process context, with no other operation of
+ * the same sensor in flight.
+ */
+struct sensirion_ops {
+	int	(*start)(struct sensirion_sensor *sensor,
+			 enum sensirion_channel channel);
+	int	(*read)(struct sensirion_sensor *sensor,
+			enum sensirion_channel channel, u16 *ticks);
+	void	(*recover)(struct sensirion_sensor *sensor);
+};
+
+/**
+ * struct sensirion_sensor - one sensor, embedded in the backend's data
+ * @dev: parent device; its driver data is set to the sensor
+ * @name: hwmon name attribute
+ * @devname: name of the misc device streaming samples
+ * @family: selects the conversion formulas
+ * @resolution: SHT7x only, index into the conversion coefficients
+ *	(the status register resolution bit)
+ * @ops: transport backend
+ * @attrs: backend-specific sysfs attributes, or NULL
+ *
+ * The remaining fields are owned by the core; backends only bump
+ * @crc_errors and @retries.
+ */
+struct sensirion_sensor {
+	struct device			*dev;
+	const char			*name;
+	const char			*devname;
+	enum sensirion_family		family;
+	int				resolution;
+	const struct sensirion_ops	*ops;
+	const struct attribute_group	*attrs;
+
+	struct device		*hwmon_dev;
+	struct mutex		lock;		/* cycle start, cached values */
+	char			valid;
+	unsigned long		last_updated;
+	int			temperature;	/* milli celsius */
+	int			humidity;	/* per cent mille */
+	u16			raw_t;
+	u16			raw_rh;
+	struct sensirion_limits	limits[SENSIRION_CHANNELS];
+	unsigned long		alarms;		/* bit 2 * channel (+ 1 for max) */
+
+	enum sensirion_state	state;
+	char			issue;		/* work starts a conversion */
+	int			status;		/* result of last conversion */
+	int			retry_budget;	/* retries left this cycle */
+	unsigned long		crc_errors;
+	unsigned long		retries;
+	ktime_t			stamp;		/* start of current cycle */
+	struct workqueue_struct	*wq;
+	struct work_struct	work;		/* advances the cycle */
+	wait_queue_head_t	wait;		/* cycle completion */
+	struct wake_lock	wake_lock;	/* held while a cycle runs */
+
+	struct task_struct	*sampler;	/* background sampling thread */
+	unsigned int		interval;	/* ms between samples, 0 = off */
+	struct hrtimer		sample_timer;	/* CLOCK_MONOTONIC, next sample */
+	struct hrtimer		wall_timer;	/* CLOCK_REALTIME, same, after
+						 * a resume */
+	struct android_alarm_wakeup wakeup;	/* next sample while suspended */
+	struct sensirion_stream	*stream;	/* sample ring, outlives the sensor
+						 * while the misc device is open */
+	struct miscdevice	miscdev;
+	struct list_head	list;		/* on sensirion_sensors */
+	struct hwmon_snapshot_source snapshot;
+};
+
+extern u8 sensirion_crc8(u8 crc, const u8 *buf, size_t len);
+
+extern int sensirion_register(struct sensirion_sensor *sensor);
+extern void sensirion_unregister(struct sensirion_sensor *sensor);
+
+extern void sensirion_data_ready(struct sensirion_sensor *sensor, int status);
+
+extern int sensirion_lock_idle(struct sensirion_sensor *sensor);
+extern int sensirion_suspend(struct sensirion_sensor *sensor);
+
+static inline void sensirion_unlock(struct sensirion_sensor *sensor)
+{
+	mutex_unlock(&sensor->lock);
+}
+
+/* force the next sysfs read to measure, lock held */
+static inline void sensirion_invalidate(struct sensirion_sensor *sensor)
+{
+	sensor->valid = 0;
+}
+
+#endif /* _SENSIRION_H */
@@ -24,180 +24,130 @@
 #include <linux/init.h>
 #include <linux/slab.h>
 #include <linux/i2c.h>
-#include <linux/hwmon.h>
-#include <linux/hwmon-sysfs.h>
 #include <linux/err.h>
-#include <linux/mutex.h>
+#include <linux/timer.h>
+#include <linux/delay.h>
 #include <linux/device.h>
+#include "sensirion.h"
 
-/* I2C command bytes */
-#define SHT21_TRIG_T_MEASUREMENT_HM  0xe3
-#define SHT21_TRIG_RH_MEASUREMENT_HM 0xe5
+/* I2C command bytes, no hold master mode */
+#define SHT21_TRIG_T_MEASUREMENT_POLL	0xf3
+#define SHT21_TRIG_RH_MEASUREMENT_POLL	0xf5
+#define SHT21_SOFT_RESET		0xfe
 
-#define SHT7X_TRIG_T_MEASUREMENT_HM  0x03
-#define SHT7X_TRIG_RH_MEASUREMENT_HM 0x05
+/*
+ * Conversion times at the power-on resolution (14bit T / 12bit RH),
+ * data sheet 2.4: max 85ms and 29ms, plus some margin.
+ */
+#define SHT21_CONVERSION_T_MS		90
+#define SHT21_CONVERSION_RH_MS		35
+
+/* soft reset time, data sheet 5.5 */
+#define SHT21_RESET_MS			15
 
 /**
  * struct sht21 - SHT21 device specific data
- * @hwmon_dev: device registered with hwmon
- * @lock: mutex to protect measurement values
- * @valid: only 0 before first measurement is taken
- * @last_update: time of last update (jiffies)
- * @temperature: cached temperature measurement value
- * @humidity: cached humidity measurement value
+ * @sensor: Sensirion core state
+ * @devname: name of the sample stream misc device
+ * @client: I2C client device
+ * @timer: end of the conversion window
  */
 struct sht21 {
-	struct device *hwmon_dev;
-	struct mutex lock;
-	char valid;
-	unsigned long last_update;
-	int temperature;
-	int humidity;
+	struct sensirion_sensor sensor;
+	char devname[16];
+	struct i2c_client *client;
+	struct timer_list timer;
 };
 
-/**
- * sht21_temp_ticks_to_millicelsius() - convert raw temperature ticks to
- * milli celsius
- * @ticks: temperature ticks value received from sensor
- */
-static inline int sht21_temp_ticks_to_millicelsius(int ticks)
+static inline struct sht21 *to_sht21(struct sensirion_sensor *sensor)
 {
-	ticks &= ~0x0003; /* clear status bits */
-	/*
-	 * Formula T = -46.85 + 175.72 * ST / 2^16 from data sheet 6.2,
-	 * optimized for integer fixed point (3 digits) arithmetic
-	 */
-	return ((21965 * ticks) >> 13) - 46850;
+	return container_of(sensor, struct sht21, sensor);
 }
 
-/**
- * sht21_rh_ticks_to_per_cent_mille() - convert raw humidity ticks to
- * one-thousandths of a percent relative humidity
- * @ticks: humidity ticks value received from sensor
- */
-static inline int sht21_rh_ticks_to_per_cent_mille(int ticks)
+/* the conversion time is over, let the core fetch the result */
+static void sht21_timer(unsigned long data)
 {
-	ticks &= ~0x0003; /* clear status bits */
-	/*
-	 * Formula RH = -6 + 125 * SRH / 2^16 from data sheet 6.1,
-	 * optimized for integer fixed point (3 digits) arithmetic
-	 */
-	return ((15625 * ticks) >> 13) - 6000;
-}
+	struct sht21 *sht21 = (struct sht21 *)data;
 
-/**
- * sht21_read_word_data() - read word from register
- * @client: I2C client device
- * @reg: I2C command byte
- *
- * Returns value, negative errno on error.
- */
-static inline int sht21_read_word_data(struct i2c_client *client, u8 reg)
-{
-	int ret = i2c_smbus_read_word_data(client, reg);
-	if (ret < 0)
-		return ret;
-	/*
-	 * SMBus specifies low byte first, but the SHT21 returns MSB
-	 * first, so we have to swab16 the values
-	 */
-	return swab16(ret);
+	sensirion_data_ready(&sht21->sensor, 0);
 }
 
 /**
- * sht7x_update_measurements() - get updated measurements from device
- * @client: I2C client device
+ * sht21_start() - trigger a measurement
+ * @sensor: Sensirion core state
+ * @channel: quantity to convert
  *
- * Returns 0 on success, else negative errno.
+ * Uses no hold master mode, so the bus is free during the conversion
+ * and the adapter need not support clock stretching.
+ * Returns 0 on success, negative errno on error.
  */
-static int sht7x_update_measurements(struct i2c_client *client)
+static int sht21_start(struct sensirion_sensor *sensor,
+		       enum sensirion_channel channel)
 {
-	int ret = 0;
-	struct sht21 *sht21 = i2c_get_clientdata(client);
-
-	mutex_lock(&sht21->lock);
-	/*
-	 * Data sheet 2.4:
-	 * SHT2x should not be active for more than 10% of the time - e.g.
-	 * maximum two measurements per second at 12bit accuracy shall be made.
-	 */
-	if (time_after(jiffies, sht21->last_update + HZ / 2) || !sht21->valid) {
-		i2c_smbus_write_byte_data(client, SHT7X_TRIG_T_MEASUREMEMT_HM, SHT7X_TRIG_T_MEASUREMENT_HM);
-
-		ret = sht21_read_word_data(client, SHT7X_TRIG_T_MEASUREMENT_HM);
-		if (ret < 0)
-			goto out;
-		sht21->temperature = sht21_temp_ticks_to_millicelsius(ret);
-		ret = sht21_read_word_data(client,
-					SHT7X_TRIG_RH_MEASUREMENT_HM);
-		if (ret < 0)
-			goto out;
-		sht21->humidity = sht21_rh_ticks_to_per_cent_mille(ret);
-		sht21->last_update = jiffies;
-		sht21->valid = 1;
+	struct sht21 *sht21 = to_sht21(sensor);
+	unsigned int ms;
+	int ret;
+
+	if (channel == SENSIRION_T) {
+		ret = i2c_smbus_write_byte(sht21->client,
+					   SHT21_TRIG_T_MEASUREMENT_POLL);
+		ms = SHT21_CONVERSION_T_MS;
+	} else {
+		ret = i2c_smbus_write_byte(sht21->client,
+					   SHT21_TRIG_RH_MEASUREMENT_POLL);
+		ms = SHT21_CONVERSION_RH_MS;
 	}
-out:
-	mutex_unlock(&sht21->lock);
-
-	return ret >= 0 ? 0 : ret;
-}
-
-/**
- * sht21_show_temperature() - show temperature measurement value in sysfs
- * @dev: device
- * @attr: device attribute
- * @buf: sysfs buffer (PAGE_SIZE) where measurement values are written to
- *
- * Will be called on read access to temp1_input sysfs attribute.
- * Returns number of bytes written into buffer, negative errno on error.
- */
-static ssize_t sht21_show_temperature(struct device *dev,
-	struct device_attribute *attr,
-	char *buf)
-{
-	struct i2c_client *client = to_i2c_client(dev);
-	struct sht21 *sht21 = i2c_get_clientdata(client);
-	int ret = sht7x_update_measurements(client);
 	if (ret < 0)
 		return ret;
-	return sprintf(buf, "%d\n", sht21->temperature);
+
+	mod_timer(&sht21->timer, jiffies + msecs_to_jiffies(ms) + 1);
+	return 0;
 }
 
 /**
- * sht21_show_humidity() - show humidity measurement value in sysfs
- * @dev: device
- * @attr: device attribute
- * @buf: sysfs buffer (PAGE_SIZE) where measurement values are written to
+ * sht21_read() - read a measurement result
+ * @sensor: Sensirion core state
+ * @channel: quantity converted
+ * @ticks: result, MSB first on the wire
  *
- * Will be called on read access to humidity1_input sysfs attribute.
- * Returns number of bytes written into buffer, negative errno on error.
+ * The checksum covers both data bytes and starts from 0 (data sheet
+ * 5.7).  Returns 0 on success, negative errno on error.
  */
-static ssize_t sht21_show_humidity(struct device *dev,
-	struct device_attribute *attr,
-	char *buf)
+static int sht21_read(struct sensirion_sensor *sensor,
+		      enum sensirion_channel channel, u16 *ticks)
 {
-	struct i2c_client *client = to_i2c_client(dev);
-	struct sht21 *sht21 = i2c_get_clientdata(client);
-	int ret = sht7x_update_measurements(client);
+	struct sht21 *sht21 = to_sht21(sensor);
+	u8 buf[3];
+	int ret;
+
+	ret = i2c_master_recv(sht21->client, buf, sizeof(buf));
 	if (ret < 0)
 		return ret;
-	return sprintf(buf, "%d\n", sht21->humidity);
+	if (ret != sizeof(buf))
+		return -EIO;
+
+	if (sensirion_crc8(0, buf, 2) != buf[2]) {
+		sensor->crc_errors++;
+		return -EBADMSG;
+	}
+
+	*ticks = (buf[0] << 8) | buf[1];
+	return 0;
 }
 
-/* sysfs attributes */
-static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, sht21_show_temperature,
-	NULL, 0);
-static SENSOR_DEVICE_ATTR(humidity1_input, S_IRUGO, sht21_show_humidity,
-	NULL, 0);
+/* soft reset; also restores the default resolution */
+static void sht21_recover(struct sensirion_sensor *sensor)
+{
+	struct sht21 *sht21 = to_sht21(sensor);
 
-static struct attribute *sht21_attributes[] = {
-	&sensor_dev_attr_temp1_input.dev_attr.attr,
-	&sensor_dev_attr_humidity1_input.dev_attr.attr,
-	NULL
-};
+	i2c_smbus_write_byte(sht21->client, SHT21_SOFT_RESET);
+	msleep(SHT21_RESET_MS);
+}
 
-static const struct attribute_group sht21_attr_group = {
-	.attrs = sht21_attributes,
+static const struct sensirion_ops sht21_ops = {
+	.start		= sht21_start,
+	.read		= sht21_read,
+	.recover	= sht21_recover,
 };
 
 /**
@@ -216,9 +166,9 @@ static int __devinit sht21_probe(struct i2c_client *client,
 	int err;
 
 	if (!i2c_check_functionality(client->adapter,
-				     I2C_FUNC_SMBUS_WORD_DATA)) {
+				     I2C_FUNC_I2C | I2C_FUNC_SMBUS_BYTE)) {
 		dev_err(&client->dev,
-			"adapter does not support SMBus word transactions\n");
+			"adapter does not support plain I2C transactions\n");
 		return -ENODEV;
 	}
 
@@ -227,28 +177,27 @@ static int __devinit sht21_probe(struct i2c_client *client,
 		dev_dbg(&client->dev, "kzalloc failed\n");
 		return -ENOMEM;
 	}
-	i2c_set_clientdata(client, sht21);
-
-	mutex_init(&sht21->lock);
-
-	err = sysfs_create_group(&client->dev.kobj, &sht21_attr_group);
+	sht21->client = client;
+	setup_timer(&sht21->timer, sht21_timer, (unsigned long)sht21);
+
+	snprintf(sht21->devname, sizeof(sht21->devname), "sht21-%d-%02x",
+		 i2c_adapter_id(client->adapter), client->addr);
+	sht21->sensor.dev = &client->dev;
+	sht21->sensor.name = "sht21";
+	sht21->sensor.devname = sht21->devname;
+	sht21->sensor.family = SENSIRION_SHT2X;
+	sht21->sensor.ops = &sht21_ops;
+
+	err = sensirion_register(&sht21->sensor);
 	if (err) {
-		dev_dbg(&client->dev, "could not create sysfs files\n");
+		dev_dbg(&client->dev, "unable to register sensor\n");
 		goto fail_free;
 	}
-	sht21->hwmon_dev = hwmon_device_register(&client->dev);
-	if (IS_ERR(sht21->hwmon_dev)) {
-		dev_dbg(&client->dev, "unable to register hwmon device\n");
-		err = PTR_ERR(sht21->hwmon_dev);
-		goto fail_remove_sysfs;
-	}
 
 	dev_info(&client->dev, "initialized\n");
 
 	return 0;
 
-fail_remove_sysfs:
-	sysfs_remove_group(&client->dev.kobj, &sht21_attr_group);
 fail_free:
 	kfree(sht21);
 
@@ -261,26 +210,42 @@ fail_free:
  */
 static int __devexit sht21_remove(struct i2c_client *client)
 {
-	struct sht21 *sht21 = i2c_get_clientdata(client);
+	struct sht21 *sht21 = to_sht21(i2c_get_clientdata(client));
 
-	hwmon_device_unregister(sht21->hwmon_dev);
-	sysfs_remove_group(&client->dev.kobj, &sht21_attr_group);
+	sensirion_unregister(&sht21->sensor);
+	del_timer_sync(&sht21->timer);
 	kfree(sht21);
 
 	return 0;
 }
 
+#ifdef CONFIG_PM
+/**
+ * sht21_suspend() - refuse to suspend while a measurement is running
+ * @client: I2C client device
+ * @mesg: power management event
+ */
+static int sht21_suspend(struct i2c_client *client, pm_message_t mesg)
+{
+	return sensirion_suspend(i2c_get_clientdata(client));
+}
+#else
+#define sht21_suspend	NULL
+#endif
+
 /* Device ID table */
 static const struct i2c_device_id sht21_id[] = {
+	{ "sht21", 0 },
 	{ "sht7x", 0 },
 	{ }
 };
 MODULE_DEVICE_TABLE(i2c, sht21_id);
 
 static struct i2c_driver sht21_driver = {
-	.driver.name = "sht7x",
+	.driver.name = "sht21",
 	.probe       = sht21_probe,
 	.remove      = __devexit_p(sht21_remove),
+	.suspend     = sht21_suspend,
 	.id_table    = sht21_id,
 };
 
@@ -297,7 +262,7 @@ static int __init sht21_init(void)
 module_init(sht21_init);
 
 /**
- * sht21_init() - clean up driver
+ * sht21_exit() - clean up driver
  *
  * Called when module is removed.
  */
@@ -18,6 +18,7 @@
  *  published by the Free Software Foundation.
  */
 #include <linux/hwmon.h>
+#include <linux/hwmon-snapshot.h>
 #include <linux/init.h>
 #include <linux/err.h>
 #include <linux/delay.h>
@@ -92,6 +93,7 @@ struct ads7846 {
 #if defined(CONFIG_HWMON) || defined(CONFIG_HWMON_MODULE)
 	struct attribute_group	*attr_group;
 	struct device		*hwmon;
+	struct hwmon_snapshot_source snapshot;
 #endif
 
 	u16			model;
@@ -371,6 +373,43 @@ static struct attribute_group ads7845_attr_group = {
 	.attrs = ads7845_attributes,
 };
 
+/*
+ * Snapshot channels, same units as the hwmon attributes.  ADS7843/5
+ * lack the temperature inputs and use a tail of these tables.
+ */
+static const char * const ads784x_snapshot_names[] = {
+	"temp0", "temp1", "in0", "in1",
+};
+
+static const struct {
+	unsigned	command;
+	unsigned	(*adjust)(struct ads7846 *ts, ssize_t v);
+} ads784x_snapshot_chans[] = {
+	{ READ_12BIT_SER(temp0) | ADS_PD10_ALL_ON, null_adjust },
+	{ READ_12BIT_SER(temp1) | ADS_PD10_ALL_ON, null_adjust },
+	{ READ_12BIT_SER(vaux) | ADS_PD10_ALL_ON, vaux_adjust },
+	{ READ_12BIT_SER(vbatt) | ADS_PD10_ALL_ON, vbatt_adjust },
+};
+
+static int ads784x_snapshot_read(struct hwmon_snapshot_source *src,
+				 s32 *vals)
+{
+	struct ads7846 *ts = container_of(src, struct ads7846, snapshot);
+	unsigned first = src->channels - ads784x_snapshot_names;
+	unsigned i;
+	ssize_t v;
+
+	for (i = 0; i < src->nchannels; i++) {
+		v = ads7846_read12_ser(&ts->spi->dev,
+				ads784x_snapshot_chans[first + i].command);
+		if (v < 0)
+			return v;
+		vals[i] = ads784x_snapshot_chans[first + i].adjust(ts, v);
+	}
+
+	return 0;
+}
+
 static int ads784x_hwmon_register(struct spi_device *spi, struct ads7846 *ts)
 {
 	struct device *hwmon;
@@ -399,12 +438,18 @@ static int ads784x_hwmon_register(struct spi_device *spi, struct ads7846 *ts)
 	switch (ts->model) {
 	case 7846:
 		ts->attr_group = &ads7846_attr_group;
+		ts->snapshot.channels = ads784x_snapshot_names;
+		ts->snapshot.nchannels = 4;
 		break;
 	case 7845:
 		ts->attr_group = &ads7845_attr_group;
+		ts->snapshot.channels = ads784x_snapshot_names + 2;
+		ts->snapshot.nchannels = 1;
 		break;
 	case 7843:
 		ts->attr_group = &ads7843_attr_group;
+		ts->snapshot.channels = ads784x_snapshot_names + 2;
+		ts->snapshot.nchannels = 2;
 		break;
 	default:
 		dev_dbg(&spi->dev, "ADS%d not recognized\n", ts->model);
@@ -421,6 +466,15 @@ static int ads784x_hwmon_register(struct spi_device *spi, struct ads7846 *ts)
 		return PTR_ERR(hwmon);
 	}
 
+	ts->snapshot.name = dev_name(&spi->dev);
+	ts->snapshot.read = ads784x_snapshot_read;
+	err = hwmon_snapshot_register(&ts->snapshot);
+	if (err) {
+		hwmon_device_unregister(hwmon);
+		sysfs_remove_group(&spi->dev.kobj, ts->attr_group);
+		return err;
+	}
+
 	ts->hwmon = hwmon;
 	return 0;
 }
@@ -429,6 +483,7 @@ static void ads784x_hwmon_unregister(struct spi_device *spi,
 				     struct ads7846 *ts)
 {
 	if (ts->hwmon) {
+		hwmon_snapshot_unregister(&ts->snapshot);
 		sysfs_remove_group(&spi->dev.kobj, ts->attr_group);
 		hwmon_device_unregister(ts->hwmon);
 	}
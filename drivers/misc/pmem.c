@@ -19,6 +19,7 @@
 #include <linux/file.h>
 #include <linux/mm.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/debugfs.h>
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
@@ -28,8 +29,9 @@
 #include <asm/cacheflush.h>
 
 #define PMEM_MAX_DEVICES 10
-#define PMEM_MAX_ORDER 128
 #define PMEM_MIN_ALLOC PAGE_SIZE
+/* free extents are reported in log2 buckets of PMEM_MIN_ALLOC units */
+#define PMEM_FRAG_BUCKETS 16
 
 #define PMEM_DEBUG 1
 
@@ -51,7 +53,7 @@
 
 
 struct pmem_data {
-	/* in alloc mode: an index into the bitmap
+	/* in alloc mode: the first PMEM_MIN_ALLOC unit of the allocation
 	 * in no_alloc mode: the size of the allocation */
 	int index;
 	/* see flags above for descriptions */
@@ -79,9 +81,14 @@ struct pmem_data {
 #endif
 };
 
-struct pmem_bits {
-	unsigned allocated:1;		/* 1 if allocated, 0 if free */
-	unsigned order:7;		/* size of the region in pmem space */
+/* a run of PMEM_MIN_ALLOC units, either free or backing one allocation.
+ * free extents sit in both the free_by_start and free_by_size trees,
+ * allocated extents only in alloc_by_start */
+struct pmem_extent {
+	unsigned long start;
+	unsigned long len;
+	struct rb_node start_node;
+	struct rb_node size_node;
 };
 
 struct pmem_region_node {
@@ -111,11 +118,21 @@ struct pmem_info {
 	unsigned long num_entries;
 	/* pfn of the garbage page in memory */
 	unsigned long garbage_pfn;
-	/* index of the garbage page in the pmem space */
-	int garbage_index;
-	/* the bitmap for the region indicating which entries are allocated
-	 * and which are free */
-	struct pmem_bits *bitmap;
+	/* free extents sorted by start, used to coalesce on free */
+	struct rb_root free_by_start;
+	/* free extents sorted by (len, start), used for the best fit search */
+	struct rb_root free_by_size;
+	/* allocated extents sorted by start, looked up by pmem_data->index */
+	struct rb_root alloc_by_start;
+	/* allocator statistics, in PMEM_MIN_ALLOC units where applicable */
+	unsigned long free_units;
+	unsigned long free_extents;
+	unsigned long allocations;
+	unsigned long splits;
+	unsigned long merges;
+	unsigned long failed;
+	/* failures where enough space was free, just not contiguous */
+	unsigned long failed_fragmented;
 	/* indicates the region should not be managed with an allocator */
 	unsigned no_allocator;
 	/* indicates maps of this region should be cached, if a mix of
@@ -131,19 +148,18 @@ struct pmem_info {
 	 * needed */
 	struct semaphore data_list_sem;
 	struct list_head data_list;
-	/* pmem_sem protects the bitmap array
-	 * a write lock should be held when modifying entries in bitmap
-	 * a read lock should be held when reading data from bits or
-	 * dereferencing a pointer into bitmap
+	/* alloc_sem protects the extent trees and the allocator statistics
+	 * a write lock should be held when allocating or freeing
+	 * a read lock should be held when looking up or walking extents
 	 *
 	 * pmem_data->sem protects the pmem data of a particular file
 	 * Many of the function that require the pmem_data->sem have a non-
 	 * locking version for when the caller is already holding that sem.
 	 *
 	 * IF YOU TAKE BOTH LOCKS TAKE THEM IN THIS ORDER:
-	 * down(pmem_data->sem) => down(bitmap_sem)
+	 * down(pmem_data->sem) => down(alloc_sem)
 	 */
-	struct rw_semaphore bitmap_sem;
+	struct rw_semaphore alloc_sem;
 
 	long (*ioctl)(struct file *, unsigned int, unsigned long);
 	int (*release)(struct inode *, struct file *);
@@ -152,18 +168,8 @@ struct pmem_info {
 static struct pmem_info pmem[PMEM_MAX_DEVICES];
 static int id_count;
 
-#define PMEM_IS_FREE(id, index) !(pmem[id].bitmap[index].allocated)
-#define PMEM_ORDER(id, index) pmem[id].bitmap[index].order
-#define PMEM_BUDDY_INDEX(id, index) (index ^ (1 << PMEM_ORDER(id, index)))
-#define PMEM_NEXT_INDEX(id, index) (index + (1 << PMEM_ORDER(id, index)))
-#define PMEM_OFFSET(index) (index * PMEM_MIN_ALLOC)
+#define PMEM_OFFSET(index) ((index) * PMEM_MIN_ALLOC)
 #define PMEM_START_ADDR(id, index) (PMEM_OFFSET(index) + pmem[id].base)
-#define PMEM_LEN(id, index) ((1 << PMEM_ORDER(id, index)) * PMEM_MIN_ALLOC)
-#define PMEM_END_ADDR(id, index) (PMEM_START_ADDR(id, index) + \
-	PMEM_LEN(id, index))
-#define PMEM_START_VADDR(id, index) (PMEM_OFFSET(id, index) + pmem[id].vbase)
-#define PMEM_END_VADDR(id, index) (PMEM_START_VADDR(id, index) + \
-	PMEM_LEN(id, index))
 #define PMEM_REVOKED(data) (data->flags & PMEM_FLAGS_REVOKED)
 #define PMEM_IS_PAGE_ALIGNED(addr) (!((addr) & (~PAGE_MASK)))
 #define PMEM_IS_SUBMAP(data) ((data->flags & PMEM_FLAGS_SUBMAP) && \
@@ -232,34 +238,114 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+static void pmem_insert_by_start(struct rb_root *root,
+				 struct pmem_extent *ext)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct pmem_extent *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct pmem_extent, start_node);
+		if (ext->start < entry->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->start_node, parent, p);
+	rb_insert_color(&ext->start_node, root);
+}
+
+static void pmem_insert_by_size(struct rb_root *root, struct pmem_extent *ext)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct pmem_extent *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct pmem_extent, size_node);
+		if (ext->len < entry->len ||
+		    (ext->len == entry->len && ext->start < entry->start))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->size_node, parent, p);
+	rb_insert_color(&ext->size_node, root);
+}
+
+static struct pmem_extent *pmem_find_allocated(int id, int index)
+{
+	/* caller should hold at least the read lock on alloc_sem! */
+	struct rb_node *n = pmem[id].alloc_by_start.rb_node;
+	struct pmem_extent *ext;
+
+	while (n) {
+		ext = rb_entry(n, struct pmem_extent, start_node);
+		if (index < ext->start)
+			n = n->rb_left;
+		else if (index > ext->start)
+			n = n->rb_right;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
 static int pmem_free(int id, int index)
 {
-	/* caller should hold the write lock on pmem_sem! */
-	int buddy, curr = index;
+	/* caller should hold the write lock on alloc_sem! */
+	struct pmem_extent *ext, *prev = NULL, *next = NULL;
+	struct rb_node *n;
 	DLOG("index %d\n", index);
 
 	if (pmem[id].no_allocator) {
 		pmem[id].allocated = 0;
 		return 0;
 	}
-	/* clean up the bitmap, merging any buddies */
-	pmem[id].bitmap[curr].allocated = 0;
-	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
-	 * if the buddy is also free merge them
-	 * repeat until the buddy is not free or end of the bitmap is reached
-	 */
-	do {
-		buddy = PMEM_BUDDY_INDEX(id, curr);
-		if (PMEM_IS_FREE(id, buddy) &&
-				PMEM_ORDER(id, buddy) == PMEM_ORDER(id, curr)) {
-			PMEM_ORDER(id, buddy)++;
-			PMEM_ORDER(id, curr)++;
-			curr = min(buddy, curr);
-		} else {
-			break;
-		}
-	} while (curr < pmem[id].num_entries);
 
+	ext = pmem_find_allocated(id, index);
+	if (!ext) {
+		printk(KERN_ERR "pmem: freeing unknown allocation %d!\n",
+		       index);
+		return -EINVAL;
+	}
+	rb_erase(&ext->start_node, &pmem[id].alloc_by_start);
+	pmem[id].allocations--;
+	pmem[id].free_units += ext->len;
+
+	/* put it back with the free extents and merge it with whichever of
+	 * its neighbours it touches, so the free trees never hold two
+	 * adjacent extents */
+	pmem_insert_by_start(&pmem[id].free_by_start, ext);
+	n = rb_prev(&ext->start_node);
+	if (n)
+		prev = rb_entry(n, struct pmem_extent, start_node);
+	n = rb_next(&ext->start_node);
+	if (n)
+		next = rb_entry(n, struct pmem_extent, start_node);
+
+	if (prev && prev->start + prev->len == ext->start) {
+		rb_erase(&prev->size_node, &pmem[id].free_by_size);
+		rb_erase(&ext->start_node, &pmem[id].free_by_start);
+		prev->len += ext->len;
+		kfree(ext);
+		ext = prev;
+		pmem[id].merges++;
+	} else {
+		pmem[id].free_extents++;
+	}
+	if (next && ext->start + ext->len == next->start) {
+		rb_erase(&next->size_node, &pmem[id].free_by_size);
+		rb_erase(&next->start_node, &pmem[id].free_by_start);
+		ext->len += next->len;
+		kfree(next);
+		pmem[id].free_extents--;
+		pmem[id].merges++;
+	}
+	pmem_insert_by_size(&pmem[id].free_by_size, ext);
 	return 0;
 }
 
@@ -297,9 +383,9 @@ static int pmem_release(struct inode *inode, struct file *file)
 
 	/* if its not a conencted file and it has an allocation, free it */
 	if (!(PMEM_FLAGS_CONNECTED & data->flags) && has_allocation(file)) {
-		down_write(&pmem[id].bitmap_sem);
+		down_write(&pmem[id].alloc_sem);
 		ret = pmem_free(id, data->index);
-		up_write(&pmem[id].bitmap_sem);
+		up_write(&pmem[id].alloc_sem);
 	}
 
 	/* if this file is a submap (mapped, connected file), downref the
@@ -364,26 +450,32 @@ static int pmem_open(struct inode *inode, struct file *file)
 	return ret;
 }
 
-static unsigned long pmem_order(unsigned long len)
+static struct pmem_extent *pmem_best_fit(int id, unsigned long units)
 {
-	int i;
-
-	len = (len + PMEM_MIN_ALLOC - 1)/PMEM_MIN_ALLOC;
-	len--;
-	for (i = 0; i < sizeof(len)*8; i++)
-		if (len >> i == 0)
-			break;
-	return i;
+	/* caller should hold the write lock on alloc_sem! */
+	struct rb_node *n = pmem[id].free_by_size.rb_node;
+	struct pmem_extent *ext, *best_fit = NULL;
+
+	/* the smallest extent that is large enough, lowest address first
+	 * among equally sized ones */
+	while (n) {
+		ext = rb_entry(n, struct pmem_extent, size_node);
+		if (ext->len >= units) {
+			best_fit = ext;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+	return best_fit;
 }
 
 static int pmem_allocate(int id, unsigned long len)
 {
-	/* caller should hold the write lock on pmem_sem! */
-	/* return the corresponding pdata[] entry */
-	int curr = 0;
-	int end = pmem[id].num_entries;
-	int best_fit = -1;
-	unsigned long order = pmem_order(len);
+	/* caller should hold the write lock on alloc_sem! */
+	/* return the index of the first unit of the allocation */
+	struct pmem_extent *best_fit, *ext;
+	unsigned long units;
 
 	if (pmem[id].no_allocator) {
 		DLOG("no allocator");
@@ -393,49 +485,46 @@ static int pmem_allocate(int id, unsigned long len)
 		return len;
 	}
 
-	if (order > PMEM_MAX_ORDER)
+	units = (len + PMEM_MIN_ALLOC - 1) / PMEM_MIN_ALLOC;
+	if (units == 0 || units > pmem[id].num_entries)
 		return -1;
-	DLOG("order %lx\n", order);
+	DLOG("units %lx\n", units);
 
-	/* look through the bitmap:
-	 * 	if you find a free slot of the correct order use it
-	 * 	otherwise, use the best fit (smallest with size > order) slot
-	 */
-	while (curr < end) {
-		if (PMEM_IS_FREE(id, curr)) {
-			if (PMEM_ORDER(id, curr) == (unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_ORDER(id, curr) > (unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_ORDER(id, curr) < PMEM_ORDER(id, best_fit)))
-				best_fit = curr;
-		}
-		curr = PMEM_NEXT_INDEX(id, curr);
-	}
-
-	/* if best_fit < 0, there are no suitable slots,
-	 * return an error
-	 */
-	if (best_fit < 0) {
+	best_fit = pmem_best_fit(id, units);
+	if (!best_fit) {
+		pmem[id].failed++;
+		if (pmem[id].free_units >= units)
+			pmem[id].failed_fragmented++;
 		printk("pmem: no space left to allocate!\n");
 		return -1;
 	}
 
-	/* now partition the best fit:
-	 * 	split the slot into 2 buddies of order - 1
-	 * 	repeat until the slot is of the correct order
-	 */
-	while (PMEM_ORDER(id, best_fit) > (unsigned char)order) {
-		int buddy;
-		PMEM_ORDER(id, best_fit) -= 1;
-		buddy = PMEM_BUDDY_INDEX(id, best_fit);
-		PMEM_ORDER(id, buddy) = PMEM_ORDER(id, best_fit);
+	rb_erase(&best_fit->size_node, &pmem[id].free_by_size);
+	if (best_fit->len == units) {
+		rb_erase(&best_fit->start_node, &pmem[id].free_by_start);
+		pmem[id].free_extents--;
+		ext = best_fit;
+	} else {
+		/* carve the allocation off the front, the remainder keeps its
+		 * place in free_by_start since its order there can't change */
+		ext = kmalloc(sizeof(struct pmem_extent), GFP_KERNEL);
+		if (!ext) {
+			pmem_insert_by_size(&pmem[id].free_by_size, best_fit);
+			printk(KERN_ERR "pmem: no memory for allocator "
+			       "metadata!\n");
+			return -1;
+		}
+		ext->start = best_fit->start;
+		ext->len = units;
+		best_fit->start += units;
+		best_fit->len -= units;
+		pmem_insert_by_size(&pmem[id].free_by_size, best_fit);
+		pmem[id].splits++;
 	}
-	pmem[id].bitmap[best_fit].allocated = 1;
-	return best_fit;
+	pmem_insert_by_start(&pmem[id].alloc_by_start, ext);
+	pmem[id].allocations++;
+	pmem[id].free_units -= units;
+	return ext->start;
 }
 
 static pgprot_t phys_mem_access_prot(struct file *file, pgprot_t vma_prot)
@@ -468,10 +557,18 @@ static void *pmem_start_vaddr(int id, struct pmem_data *data)
 
 static unsigned long pmem_len(int id, struct pmem_data *data)
 {
+	struct pmem_extent *ext;
+	unsigned long len = 0;
+
 	if (pmem[id].no_allocator)
 		return data->index;
-	else
-		return PMEM_LEN(id, data->index);
+
+	down_read(&pmem[id].alloc_sem);
+	ext = pmem_find_allocated(id, data->index);
+	if (ext)
+		len = ext->len * PMEM_MIN_ALLOC;
+	up_read(&pmem[id].alloc_sem);
+	return len;
 }
 
 static int pmem_map_garbage(int id, struct vm_area_struct *vma,
@@ -606,9 +703,9 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 	}
 	/* if file->private_data == unalloced, alloc*/
 	if (data && data->index == -1) {
-		down_write(&pmem[id].bitmap_sem);
+		down_write(&pmem[id].alloc_sem);
 		index = pmem_allocate(id, vma->vm_end - vma->vm_start);
-		up_write(&pmem[id].bitmap_sem);
+		up_write(&pmem[id].alloc_sem);
 		data->index = index;
 	}
 	/* either no space was available or an error occured */
@@ -1141,7 +1238,9 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			if (has_allocation(file))
 				return -EINVAL;
 			data = (struct pmem_data *)file->private_data;
+			down_write(&pmem[id].alloc_sem);
 			data->index = pmem_allocate(id, arg);
+			up_write(&pmem[id].alloc_sem);
 			break;
 		}
 	case PMEM_CONNECT:
@@ -1157,6 +1256,53 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 }
 
 #if PMEM_DEBUG
+static int debug_allocator_stats(int id, char *buffer, int n, int bufmax)
+{
+	unsigned long hist[PMEM_FRAG_BUCKETS];
+	unsigned long largest = 0, frag = 0;
+	struct pmem_extent *ext;
+	struct rb_node *rb;
+	int i;
+
+	if (pmem[id].no_allocator)
+		return n;
+
+	memset(hist, 0, sizeof(hist));
+	down_read(&pmem[id].alloc_sem);
+	rb = rb_last(&pmem[id].free_by_size);
+	if (rb)
+		largest = rb_entry(rb, struct pmem_extent, size_node)->len;
+	for (rb = rb_first(&pmem[id].free_by_start); rb; rb = rb_next(rb)) {
+		ext = rb_entry(rb, struct pmem_extent, start_node);
+		i = min(fls(ext->len) - 1, PMEM_FRAG_BUCKETS - 1);
+		hist[i]++;
+	}
+	/* how much of the free space can't be handed out in one piece */
+	if (pmem[id].free_units)
+		frag = 100 - largest * 100 / pmem[id].free_units;
+
+	n += scnprintf(buffer + n, bufmax - n,
+		       "total %lu free %lu largest free %lu (units of %lu)\n"
+		       "allocations %lu free extents %lu fragmentation %lu%%\n"
+		       "splits %lu merges %lu failed %lu (fragmented %lu)\n"
+		       "free extents by size:",
+		       pmem[id].num_entries, pmem[id].free_units, largest,
+		       PMEM_MIN_ALLOC, pmem[id].allocations,
+		       pmem[id].free_extents, frag, pmem[id].splits,
+		       pmem[id].merges, pmem[id].failed,
+		       pmem[id].failed_fragmented);
+	up_read(&pmem[id].alloc_sem);
+
+	for (i = 0; i < PMEM_FRAG_BUCKETS; i++)
+		if (hist[i])
+			n += scnprintf(buffer + n, bufmax - n, " %lu%s:%lu",
+				       1UL << i,
+				       i == PMEM_FRAG_BUCKETS - 1 ? "+" : "",
+				       hist[i]);
+	n += scnprintf(buffer + n, bufmax - n, "\n");
+	return n;
+}
+
 static ssize_t debug_open(struct inode *inode, struct file *file)
 {
 	file->private_data = inode->i_private;
@@ -1175,7 +1321,8 @@ static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 	int n = 0;
 
 	DLOG("debug open\n");
-	n = scnprintf(buffer, debug_bufmax,
+	n = debug_allocator_stats(id, buffer, 0, debug_bufmax);
+	n += scnprintf(buffer + n, debug_bufmax - n,
 		      "pid #: mapped regions (offset, len) (offset,len)...\n");
 
 	down(&pmem[id].data_list_sem);
@@ -1220,7 +1367,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	       int (*release)(struct inode *, struct file *))
 {
 	int err = 0;
-	int i, index = 0;
+	struct pmem_extent *ext;
 	int id = id_count;
 	id_count++;
 
@@ -1231,7 +1378,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].size = pdata->size;
 	pmem[id].ioctl = ioctl;
 	pmem[id].release = release;
-	init_rwsem(&pmem[id].bitmap_sem);
+	init_rwsem(&pmem[id].alloc_sem);
 	init_MUTEX(&pmem[id].data_list_sem);
 	INIT_LIST_HEAD(&pmem[id].data_list);
 	pmem[id].dev.name = pdata->name;
@@ -1246,20 +1393,20 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	}
 	pmem[id].num_entries = pmem[id].size / PMEM_MIN_ALLOC;
 
-	pmem[id].bitmap = kmalloc(pmem[id].num_entries *
-				  sizeof(struct pmem_bits), GFP_KERNEL);
-	if (!pmem[id].bitmap)
-		goto err_no_mem_for_metadata;
-
-	memset(pmem[id].bitmap, 0, sizeof(struct pmem_bits) *
-					  pmem[id].num_entries);
+	pmem[id].free_by_start = RB_ROOT;
+	pmem[id].free_by_size = RB_ROOT;
+	pmem[id].alloc_by_start = RB_ROOT;
 
-	for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--) {
-		if ((pmem[id].num_entries) &  1<<i) {
-			PMEM_ORDER(id, index) = i;
-			index = PMEM_NEXT_INDEX(id, index);
-		}
-	}
+	/* the whole region starts out as a single free extent */
+	ext = kmalloc(sizeof(struct pmem_extent), GFP_KERNEL);
+	if (!ext)
+		goto err_no_mem_for_metadata;
+	ext->start = 0;
+	ext->len = pmem[id].num_entries;
+	pmem_insert_by_start(&pmem[id].free_by_start, ext);
+	pmem_insert_by_size(&pmem[id].free_by_size, ext);
+	pmem[id].free_units = ext->len;
+	pmem[id].free_extents = 1;
 
 	if (pmem[id].cached)
 		pmem[id].vbase = ioremap_cached(pmem[id].base,
@@ -1285,7 +1432,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 #endif
 	return 0;
 error_cant_remap:
-	kfree(pmem[id].bitmap);
+	kfree(ext);
 err_no_mem_for_metadata:
 	misc_deregister(&pmem[id].dev);
 err_cant_register_device:
@@ -19,7 +19,6 @@
  *	rework for 2K page size chips
  *
  *  TODO:
- *	Enable cached programming for 2k page size chips
  *	Check, if mtd->ecctype should be set to MTD_ECC_HW
  *	if we have HW ecc support.
  *	The AG-AND chips have nice features for speed improvement,
@@ -1041,6 +1040,7 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 	struct mtd_ecc_stats stats;
 	int blkcheck = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
 	int sndcmd = 1;
+	int cacheread = 0;
 	int ret = 0;
 	uint32_t readlen = ops->len;
 	uint32_t oobreadlen = ops->ooblen;
@@ -1068,7 +1068,38 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			bufpoi = aligned ? buf : chip->buffers->databuf;
 
 			if (likely(sndcmd)) {
-				chip->cmdfunc(mtd, NAND_CMD_READ0, 0x00, page);
+				/*
+				 * Keep a cache read going as long as whole
+				 * pages follow in this block, and the next
+				 * one isn't served from the page buffer.
+				 */
+				int more = readlen - bytes >= mtd->writesize &&
+					((page + 1) & blkcheck) &&
+					realpage + 1 != chip->pagebuf;
+
+				if (cacheread) {
+					/*
+					 * This page was fetched while the last
+					 * one was clocked out, move it to the
+					 * cache register and fetch the next
+					 */
+					chip->cmdfunc(mtd, more ?
+						      NAND_CMD_READCACHESEQ :
+						      NAND_CMD_READCACHEEND,
+						      -1, -1);
+					cacheread = more;
+				} else {
+					chip->cmdfunc(mtd, NAND_CMD_READ0,
+						      0x00, page);
+					if (more && aligned &&
+					    NAND_HAS_CACHEREAD(chip) &&
+					    !NAND_CANAUTOINCR(chip)) {
+						chip->cmdfunc(mtd,
+						      NAND_CMD_READCACHESEQ,
+						      -1, -1);
+						cacheread = 1;
+					}
+				}
 				sndcmd = 0;
 			}
 
@@ -1149,6 +1180,10 @@ static int nand_do_read_ops(struct mtd_info *mtd, loff_t from,
 			sndcmd = 1;
 	}
 
+	/* Bailed out in the middle of a cache read, stop the chip */
+	if (cacheread)
+		chip->cmdfunc(mtd, NAND_CMD_READCACHEEND, -1, -1);
+
 	ops->retlen = ops->len - (size_t) readlen;
 	if (oob)
 		ops->oobretlen = ops->ooblen - oobreadlen;
@@ -1609,12 +1644,6 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 	else
 		chip->ecc.write_page(mtd, chip, buf);
 
-	/*
-	 * Cached progamming disabled for now, Not sure if its worth the
-	 * trouble. The speed gain is not very impressive. (2.3->2.6Mib/s)
-	 */
-	cached = 0;
-
 	if (!cached || !(chip->options & NAND_CACHEPRG)) {
 
 		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
@@ -1627,11 +1656,28 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 			status = chip->errstat(mtd, chip, FL_WRITING, status,
 					       page);
 
+		/* the last cached page is reported alongside */
+		if (chip->cached_prog) {
+			chip->cached_prog = 0;
+			if (status & NAND_STATUS_FAIL_N1)
+				return -EIO;
+		}
+
 		if (status & NAND_STATUS_FAIL)
 			return -EIO;
 	} else {
+		/*
+		 * The chip is ready for the next page as soon as this one
+		 * moved to the data register, programming overlaps with the
+		 * next transfer. Only the previous page's result is known.
+		 */
 		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
 		status = chip->waitfunc(mtd, chip);
+		if (chip->cached_prog && (status & NAND_STATUS_FAIL_N1)) {
+			chip->cached_prog = 0;
+			return -EIO;
+		}
+		chip->cached_prog = 1;
 	}
 
 #ifdef CONFIG_MTD_NAND_VERIFY_WRITE
@@ -1755,6 +1801,11 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		int cached = writelen > bytes && page != blockmask;
 		uint8_t *wbuf = buf;
 
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+		/* the read back can't overlap with a cached program */
+		cached = 0;
+#endif
+
 		/* Partial page write ? */
 		if (unlikely(column || writelen < (mtd->writesize - 1))) {
 			cached = 0;
@@ -1990,6 +2041,50 @@ static void multi_erase_cmd(struct mtd_info *mtd, int page)
 	chip->cmdfunc(mtd, NAND_CMD_ERASE2, -1, -1);
 }
 
+/**
+ * plane_erase_cmd - [GENERIC] two-plane block erase command function
+ * @mtd:	MTD device structure
+ * @page:	the page address of the first block, in plane 0
+ *
+ * Erase a block and the block after it, which sits in the other plane,
+ * in one tBERS (Samsung 60h-60h-D0h sequence)
+ */
+static void plane_erase_cmd(struct mtd_info *mtd, int page)
+{
+	struct nand_chip *chip = mtd->priv;
+	int pages_per_block = 1 << (chip->phys_erase_shift - chip->page_shift);
+
+	chip->cmdfunc(mtd, NAND_CMD_ERASE1, -1, page);
+	chip->cmdfunc(mtd, NAND_CMD_ERASE1, -1, page + pages_per_block);
+	chip->cmdfunc(mtd, NAND_CMD_ERASE2, -1, -1);
+}
+
+/**
+ * nand_erase_block - [Internal] erase one block and wait for it
+ * @mtd:	MTD device structure
+ * @page:	the page address of the block
+ *
+ * Returns the chip status
+ */
+static int nand_erase_block(struct mtd_info *mtd, int page)
+{
+	struct nand_chip *chip = mtd->priv;
+	int status;
+
+	chip->erase_cmd(mtd, page & chip->pagemask);
+
+	status = chip->waitfunc(mtd, chip);
+
+	/*
+	 * See if operation failed and additional status checks are
+	 * available
+	 */
+	if ((status & NAND_STATUS_FAIL) && (chip->errstat))
+		status = chip->errstat(mtd, chip, FL_ERASING, status, page);
+
+	return status;
+}
+
 /**
  * nand_erase - [MTD Interface] erase block(s)
  * @mtd:	MTD device structure
@@ -2014,7 +2109,7 @@ static int nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 		    int allowbbt)
 {
-	int page, status, pages_per_block, ret, chipnr;
+	int page, status, pages_per_block, ret, chipnr, blocks, i;
 	struct nand_chip *chip = mtd->priv;
 	loff_t rewrite_bbt[NAND_MAX_CHIPS]={0};
 	unsigned int bbt_masked_page = 0xffffffff;
@@ -2092,25 +2187,39 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 			goto erase_exit;
 		}
 
+		/*
+		 * Take the block in the other plane along if it's part of
+		 * the range, on the same chip and good as well
+		 */
+		blocks = 1;
+		if (chip->plane_erase_cmd &&
+		    !(page & pages_per_block) &&
+		    len >= (2 << chip->phys_erase_shift) &&
+		    ((page + pages_per_block) & chip->pagemask) &&
+		    !nand_block_checkbad(mtd, ((loff_t) (page + pages_per_block))
+					 << chip->page_shift, 0, allowbbt))
+			blocks = 2;
+
 		/*
 		 * Invalidate the page cache, if we erase the block which
 		 * contains the current cached page
 		 */
 		if (page <= chip->pagebuf && chip->pagebuf <
-		    (page + pages_per_block))
+		    (page + blocks * pages_per_block))
 			chip->pagebuf = -1;
 
-		chip->erase_cmd(mtd, page & chip->pagemask);
-
-		status = chip->waitfunc(mtd, chip);
-
-		/*
-		 * See if operation failed and additional status checks are
-		 * available
-		 */
-		if ((status & NAND_STATUS_FAIL) && (chip->errstat))
-			status = chip->errstat(mtd, chip, FL_ERASING,
-					       status, page);
+		if (blocks == 2) {
+			chip->plane_erase_cmd(mtd, page & chip->pagemask);
+			status = chip->waitfunc(mtd, chip);
+			/*
+			 * The status doesn't tell which plane failed, go
+			 * through them one by one to find out
+			 */
+			if (status & NAND_STATUS_FAIL)
+				blocks = 1;
+		}
+		if (blocks == 1)
+			status = nand_erase_block(mtd, page);
 
 		/* See if block erase succeeded */
 		if (status & NAND_STATUS_FAIL) {
@@ -2126,14 +2235,15 @@ int nand_erase_nand(struct mtd_info *mtd, struct erase_info *instr,
 		 * If BBT requires refresh, set the BBT rewrite flag to the
 		 * page being erased
 		 */
-		if (bbt_masked_page != 0xffffffff &&
-		    (page & BBT_PAGE_MASK) == bbt_masked_page)
-			    rewrite_bbt[chipnr] =
+		for (i = 0; i < blocks; i++, page += pages_per_block) {
+			if (bbt_masked_page != 0xffffffff &&
+			    (page & BBT_PAGE_MASK) == bbt_masked_page)
+				rewrite_bbt[chipnr] =
 					((loff_t)page << chip->page_shift);
 
-		/* Increment page address and decrement length */
-		len -= (1 << chip->phys_erase_shift);
-		page += pages_per_block;
+			/* Decrement length, the page address moves on */
+			len -= (1 << chip->phys_erase_shift);
+		}
 
 		/* Check, if we cross a chip boundary */
 		if (len && !(page & chip->pagemask)) {
@@ -2318,6 +2428,8 @@ static struct nand_flash_dev *nand_get_flash_type(struct mtd_info *mtd,
 	int i, dev_id, maf_idx;
 	int tmp_id, tmp_manf;
 
+	chip->planes = 1;
+
 	/* Select the device */
 	chip->select_chip(mtd, 0);
 
@@ -2377,6 +2489,9 @@ static struct nand_flash_dev *nand_get_flash_type(struct mtd_info *mtd,
 		chip->cellinfo = chip->read_byte(mtd);
 		/* The 4th id byte is the important one */
 		extid = chip->read_byte(mtd);
+		/* Samsung has the number of planes in the 5th */
+		if (*maf_id == NAND_MFR_SAMSUNG)
+			chip->planes = 1 << ((chip->read_byte(mtd) >> 2) & 0x03);
 		/* Calc pagesize */
 		mtd->writesize = 1024 << (extid & 0x3);
 		extid >>= 2;
@@ -2450,6 +2565,24 @@ static struct nand_flash_dev *nand_get_flash_type(struct mtd_info *mtd,
 	if (*maf_id != NAND_MFR_SAMSUNG && !type->pagesize)
 		chip->options &= ~NAND_SAMSUNG_LP_OPTIONS;
 
+	/*
+	 * Chips with an extended id tell whether they can cache program.
+	 * Micron parts that do also support cache read.
+	 */
+	if (!type->pagesize) {
+		if (chip->cellinfo & NAND_CI_CACHEPRG) {
+			chip->options |= NAND_CACHEPRG;
+			if (*maf_id == NAND_MFR_MICRON)
+				chip->options |= NAND_CACHERD;
+		} else {
+			chip->options &= ~NAND_CACHEPRG;
+		}
+	}
+
+	/* Two-plane erase, unless the board knows better */
+	if (chip->planes > 1 && !chip->plane_erase_cmd)
+		chip->plane_erase_cmd = plane_erase_cmd;
+
 	/* Check for AND chips with 4 page planes */
 	if (chip->options & NAND_4PAGE_ARRAY)
 		chip->erase_cmd = multi_erase_cmd;
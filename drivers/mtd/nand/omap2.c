@@ -13,6 +13,9 @@
 #include <linux/platform_device.h>
 #include <linux/dma-mapping.h>
 #include <linux/delay.h>
+#include <linux/vmalloc.h>
+#include <linux/completion.h>
+#include <linux/jiffies.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/nand_ecc.h>
@@ -21,14 +24,20 @@
 
 #include <asm/dma.h>
 
+#include <mach/dma.h>
 #include <mach/gpmc.h>
 #include <mach/nand.h>
 
+#ifdef CONFIG_MTD_NAND_OMAP_BCH
+#include "omap_bch_decoder.h"
+#endif
+
 #define GPMC_IRQ_STATUS		0x18
 #define GPMC_ECC_CONFIG		0x1F4
 #define GPMC_ECC_CONTROL	0x1F8
 #define GPMC_ECC_SIZE_CONFIG	0x1FC
 #define GPMC_ECC1_RESULT	0x200
+#define GPMC_BCH_RESULT0	0x240
 
 #define	DRIVER_NAME	"omap2-nand"
 #define	NAND_IO_SIZE	SZ_4K
@@ -112,6 +121,30 @@
 static const char *part_probes[] = { "cmdlinepart", NULL };
 #endif
 
+#ifdef CONFIG_MTD_NAND_OMAP_PREFETCH
+static int use_prefetch = 1;
+
+/* "modprobe ... use_prefetch=0" etc */
+module_param(use_prefetch, bool, 0);
+MODULE_PARM_DESC(use_prefetch, "enable/disable use of PREFETCH");
+
+#ifdef CONFIG_MTD_NAND_OMAP_PREFETCH_DMA
+static int use_dma = 1;
+
+/* "modprobe ... use_dma=0" etc */
+module_param(use_dma, bool, 0);
+MODULE_PARM_DESC(use_dma, "enable/disable use of DMA");
+#else
+static const int use_dma;
+#endif
+#endif
+
+/* shorter transfers (OOB, subpages) are not worth setting up sDMA for */
+#define NAND_DMA_MIN_LEN	512
+
+/* a stalled prefetch engine never fills or drains its FIFO */
+#define NAND_PREF_TIMEOUT	msecs_to_jiffies(100)
+
 struct omap_nand_info {
 	struct nand_hw_control		controller;
 	struct omap_nand_platform_data	*pdata;
@@ -124,6 +157,16 @@ struct omap_nand_info {
 	unsigned long			phys_base;
 	void __iomem			*gpmc_cs_baseaddr;
 	void __iomem			*gpmc_baseaddr;
+	/* chip select region, the prefetch FIFO while the engine runs */
+	void __iomem			*pref_fifo;
+	struct completion		comp;
+	int				dma_ch;
+	/* a prefetch or DMA write timed out, the next program fails */
+	int				xfer_error;
+	int (*waitfunc)(struct mtd_info *mtd, struct nand_chip *chip);
+	/* BCH correction capability, 0 when BCH isn't used */
+	int				bch_t;
+	struct nand_ecclayout		ecclayout;
 };
 
 /*
@@ -222,6 +265,315 @@ static void omap_write_buf16(struct mtd_info *mtd, const u_char * buf, int len)
 						GPMC_STATUS) & GPMC_BUF_FULL));
 	}
 }
+#ifdef CONFIG_MTD_NAND_OMAP_PREFETCH
+/*
+ * omap_prefetch_timeout - give up on a stalled prefetch engine
+ * @info: NAND device
+ * @start: jiffies when the FIFO last made progress
+ *
+ * Returns nonzero once the engine has made no progress for too long,
+ * after resetting it.
+ */
+static int omap_prefetch_timeout(struct omap_nand_info *info,
+				 unsigned long start)
+{
+	if (time_before(jiffies, start + NAND_PREF_TIMEOUT))
+		return 0;
+
+	dev_err(&info->pdev->dev, "prefetch engine stalled\n");
+	gpmc_prefetch_reset();
+	return 1;
+}
+
+/*
+ * omap_prefetch_drain - wait for the engine to flush the posted writes
+ * @info: NAND device
+ *
+ * Returns 0, or -ETIMEDOUT if the engine stalled.
+ */
+static int omap_prefetch_drain(struct omap_nand_info *info)
+{
+	unsigned long start = jiffies;
+
+	while (GPMC_PREFETCH_STATUS_COUNT(gpmc_prefetch_status())) {
+		if (omap_prefetch_timeout(info, start))
+			return -ETIMEDOUT;
+		cpu_relax();
+	}
+	return 0;
+}
+
+/*
+ * omap_read_buf_pref - read data from NAND controller into buffer
+ * through the prefetch engine
+ * @mtd: MTD device structure
+ * @buf: buffer to store date
+ * @len: number of bytes to read
+ */
+static void omap_read_buf_pref(struct mtd_info *mtd, u_char *buf, int len)
+{
+	struct omap_nand_info *info = container_of(mtd,
+						struct omap_nand_info, mtd);
+	unsigned long start;
+	u32 *p;
+	u32 status;
+	int count;
+
+	/* the FIFO is drained a word at a time, take care of a leading
+	 * half word (subpage reads) by hand */
+	if (len & 2) {
+		omap_read_buf16(mtd, buf, 2);
+		buf += 2;
+		len -= 2;
+	}
+	if (len == 0)
+		return;
+
+	if (gpmc_prefetch_enable(info->gpmc_cs, 0, len, 0)) {
+		/* engine busy, use the cpu copy method */
+		omap_read_buf16(mtd, buf, len);
+		return;
+	}
+
+	p = (u32 *) buf;
+	start = jiffies;
+	while (len) {
+		status = gpmc_prefetch_status();
+		count = GPMC_PREFETCH_STATUS_FIFO_CNT(status) >> 2;
+		if (!count) {
+			if (omap_prefetch_timeout(info, start))
+				return;
+			cpu_relax();
+			continue;
+		}
+		__raw_readsl(info->pref_fifo, p, count);
+		p += count;
+		len -= count << 2;
+		start = jiffies;
+	}
+
+	gpmc_prefetch_reset();
+}
+
+/*
+ * omap_write_buf_pref - write buffer to NAND controller through the
+ * write-posting engine
+ * @mtd: MTD device structure
+ * @buf: data buffer
+ * @len: number of bytes to write
+ */
+static void omap_write_buf_pref(struct mtd_info *mtd, const u_char *buf,
+				int len)
+{
+	struct omap_nand_info *info = container_of(mtd,
+						struct omap_nand_info, mtd);
+	unsigned long start;
+	const u32 *p;
+	u32 status;
+	int count;
+
+	if (len & 2) {
+		omap_write_buf16(mtd, buf, 2);
+		buf += 2;
+		len -= 2;
+	}
+	if (len == 0)
+		return;
+
+	if (gpmc_prefetch_enable(info->gpmc_cs, 0, len, 1)) {
+		/* engine busy, use the cpu copy method */
+		omap_write_buf16(mtd, buf, len);
+		return;
+	}
+
+	p = (const u32 *) buf;
+	start = jiffies;
+	while (len) {
+		status = gpmc_prefetch_status();
+		count = min(GPMC_PREFETCH_STATUS_FIFO_CNT(status), (u32)len) >> 2;
+		if (!count) {
+			if (omap_prefetch_timeout(info, start)) {
+				info->xfer_error = 1;
+				return;
+			}
+			cpu_relax();
+			continue;
+		}
+		__raw_writesl(info->pref_fifo, p, count);
+		p += count;
+		len -= count << 2;
+		start = jiffies;
+	}
+
+	/* let the engine flush what's still posted before handing it back */
+	if (omap_prefetch_drain(info)) {
+		info->xfer_error = 1;
+		return;
+	}
+	gpmc_prefetch_reset();
+}
+
+/*
+ * omap_nand_dma_cb - sDMA completion callback
+ * @lch: logical channel
+ * @ch_status: channel status
+ * @data: the transfer's completion
+ */
+static void omap_nand_dma_cb(int lch, u16 ch_status, void *data)
+{
+	complete((struct completion *) data);
+}
+
+/*
+ * omap_nand_dma_transfer - move a buffer between memory and the prefetch
+ * FIFO with system DMA
+ * @mtd: MTD device structure
+ * @addr: data buffer
+ * @len: number of bytes, a multiple of GPMC_PREFETCH_FIFO_SIZE
+ * @is_write: transfer direction
+ *
+ * Returns 0 on success, -ETIMEDOUT if the transfer stalled part way, or
+ * another error if nothing was transferred and the caller should fall
+ * back to the MPU prefetch path.
+ */
+static int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
+				  unsigned int len, int is_write)
+{
+	struct omap_nand_info *info = container_of(mtd,
+						struct omap_nand_info, mtd);
+	enum dma_data_direction dir = is_write ? DMA_TO_DEVICE :
+						 DMA_FROM_DEVICE;
+	dma_addr_t dma_addr;
+	int ret;
+
+	/* vmalloc'ed buffers (yaffs2, ubi) can only be handed to the DMA
+	 * engine when they don't cross a page */
+	if (addr >= high_memory) {
+		struct page *page;
+
+		if (((size_t) addr & PAGE_MASK) !=
+		    ((size_t) (addr + len - 1) & PAGE_MASK))
+			return -EINVAL;
+		page = vmalloc_to_page(addr);
+		if (!page)
+			return -EINVAL;
+		addr = page_address(page) + ((size_t) addr & ~PAGE_MASK);
+	}
+
+	dma_addr = dma_map_single(&info->pdev->dev, addr, len, dir);
+	if (dma_mapping_error(&info->pdev->dev, dma_addr)) {
+		dev_err(&info->pdev->dev,
+			"Couldn't DMA map a %d byte buffer\n", len);
+		return -ENOMEM;
+	}
+
+	/* one frame per FIFO fill, synchronised on the GPMC request */
+	if (is_write) {
+		omap_set_dma_dest_params(info->dma_ch, 0,
+				OMAP_DMA_AMODE_CONSTANT, info->phys_base, 0, 0);
+		omap_set_dma_src_params(info->dma_ch, 0,
+				OMAP_DMA_AMODE_POST_INC, dma_addr, 0, 0);
+		omap_set_dma_transfer_params(info->dma_ch,
+				OMAP_DMA_DATA_TYPE_S32,
+				GPMC_PREFETCH_FIFO_SIZE >> 2,
+				len / GPMC_PREFETCH_FIFO_SIZE,
+				OMAP_DMA_SYNC_FRAME, OMAP24XX_DMA_GPMC,
+				OMAP_DMA_DST_SYNC);
+	} else {
+		omap_set_dma_src_params(info->dma_ch, 0,
+				OMAP_DMA_AMODE_CONSTANT, info->phys_base, 0, 0);
+		omap_set_dma_dest_params(info->dma_ch, 0,
+				OMAP_DMA_AMODE_POST_INC, dma_addr, 0, 0);
+		omap_set_dma_transfer_params(info->dma_ch,
+				OMAP_DMA_DATA_TYPE_S32,
+				GPMC_PREFETCH_FIFO_SIZE >> 2,
+				len / GPMC_PREFETCH_FIFO_SIZE,
+				OMAP_DMA_SYNC_FRAME, OMAP24XX_DMA_GPMC,
+				OMAP_DMA_SRC_SYNC);
+	}
+
+	ret = gpmc_prefetch_enable(info->gpmc_cs, 1, len, is_write);
+	if (ret)
+		goto out_unmap;
+
+	init_completion(&info->comp);
+	omap_start_dma(info->dma_ch);
+	if (!wait_for_completion_timeout(&info->comp, HZ)) {
+		dev_err(&info->pdev->dev, "DMA transfer timed out\n");
+		omap_stop_dma(info->dma_ch);
+		gpmc_prefetch_reset();
+		ret = -ETIMEDOUT;
+	} else {
+		ret = omap_prefetch_drain(info);
+		if (!ret)
+			gpmc_prefetch_reset();
+	}
+	if (ret && is_write)
+		info->xfer_error = 1;
+
+out_unmap:
+	dma_unmap_single(&info->pdev->dev, dma_addr, len, dir);
+	return ret;
+}
+
+/*
+ * omap_read_buf_dma_pref - read data from NAND controller into buffer
+ * @mtd: MTD device structure
+ * @buf: buffer to store date
+ * @len: number of bytes to read
+ */
+static void omap_read_buf_dma_pref(struct mtd_info *mtd, u_char *buf, int len)
+{
+	int ret = -EINVAL;
+
+	if (len >= NAND_DMA_MIN_LEN && !(len % GPMC_PREFETCH_FIFO_SIZE))
+		ret = omap_nand_dma_transfer(mtd, buf, len, 0);
+
+	/* after a timeout the chip is part way through the page, the
+	 * ECC check catches the bad data */
+	if (ret && ret != -ETIMEDOUT)
+		omap_read_buf_pref(mtd, buf, len);
+}
+
+/*
+ * omap_write_buf_dma_pref - write buffer to NAND controller
+ * @mtd: MTD device structure
+ * @buf: data buffer
+ * @len: number of bytes to write
+ */
+static void omap_write_buf_dma_pref(struct mtd_info *mtd, const u_char *buf,
+				    int len)
+{
+	int ret = -EINVAL;
+
+	if (len >= NAND_DMA_MIN_LEN && !(len % GPMC_PREFETCH_FIFO_SIZE))
+		ret = omap_nand_dma_transfer(mtd, (u_char *) buf, len, 1);
+
+	/* after a timeout omap_wait_xfer() fails the program */
+	if (ret && ret != -ETIMEDOUT)
+		omap_write_buf_pref(mtd, buf, len);
+}
+
+/*
+ * omap_wait_xfer - wait for a program or erase, and report it failed if
+ * the page data didn't make it to the chip
+ * @mtd: MTD device structure
+ * @chip: NAND Chip structure
+ */
+static int omap_wait_xfer(struct mtd_info *mtd, struct nand_chip *chip)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+							mtd);
+	int status = info->waitfunc(mtd, chip);
+
+	if (info->xfer_error) {
+		info->xfer_error = 0;
+		status |= NAND_STATUS_FAIL;
+	}
+	return status;
+}
+#endif
+
 /*
  * omap_verify_buf - Verify chip data against buffer
  * @mtd: MTD device structure
@@ -366,6 +718,174 @@ static void omap_enable_hwecc(struct mtd_info *mtd, int mode)
 }
 #endif
 
+#ifdef CONFIG_MTD_NAND_OMAP_BCH
+/*
+ * omap_enable_hwecc_bch - start BCH syndrome generation for one sector
+ * @mtd: MTD device structure
+ * @mode: Read/Write mode
+ *
+ * The engine is run one 512 byte sector at a time, in wrap mode 6 it
+ * only looks at the data, the parity is read back separately and
+ * handed to omap_correct_data_bch().
+ */
+static void omap_enable_hwecc_bch(struct mtd_info *mtd, int mode)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+							mtd);
+	register struct nand_chip *chip = mtd->priv;
+	unsigned int dev_width = (chip->options & NAND_BUSWIDTH_16) ? 1 : 0;
+	unsigned long val;
+
+	/* ECCSIZE1 = 32 nibbles, ECCSIZE0 = 0 */
+	__raw_writel((32 << 22) | (0 << 12),
+		     info->gpmc_baseaddr + GPMC_ECC_SIZE_CONFIG);
+	/* Clear all ECC | Select result 1 */
+	__raw_writel(0x101, info->gpmc_baseaddr + GPMC_ECC_CONTROL);
+
+	val = (1 << 16) |			/* BCH */
+		((info->bch_t == 8) << 12) |	/* 8 or 4 bits */
+		(0x6 << 8) |			/* wrap mode 6 */
+		(dev_width << 7) |		/* 16 or 8 bit col */
+		(0 << 4) |			/* one sector */
+		(info->gpmc_cs << 1) |		/* CS */
+		(0x1);				/* ECC Enable */
+	__raw_writel(val, info->gpmc_baseaddr + GPMC_ECC_CONFIG);
+}
+
+/*
+ * omap_calculate_ecc_bch - read back the BCH parity of the last sector
+ * @mtd: MTD device structure
+ * @dat: The pointer to data on which ecc is computed
+ * @ecc_code: The ecc_code buffer
+ *
+ * The 52 or 104 parity bits are stored most significant byte first,
+ * left justified, which is the layout omap_bch_decode() expects.
+ */
+static int omap_calculate_ecc_bch(struct mtd_info *mtd, const u_char *dat,
+				  u_char *ecc_code)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+							mtd);
+	void __iomem *reg = info->gpmc_baseaddr + GPMC_BCH_RESULT0;
+	unsigned long val0, val1, val2, val3;
+
+	val0 = __raw_readl(reg);
+	val1 = __raw_readl(reg + 4);
+
+	if (info->bch_t == 8) {
+		val2 = __raw_readl(reg + 8);
+		val3 = __raw_readl(reg + 12);
+		*ecc_code++ = val3 & 0xff;
+		*ecc_code++ = val2 >> 24;
+		*ecc_code++ = val2 >> 16;
+		*ecc_code++ = val2 >> 8;
+		*ecc_code++ = val2;
+		*ecc_code++ = val1 >> 24;
+		*ecc_code++ = val1 >> 16;
+		*ecc_code++ = val1 >> 8;
+		*ecc_code++ = val1;
+		*ecc_code++ = val0 >> 24;
+		*ecc_code++ = val0 >> 16;
+		*ecc_code++ = val0 >> 8;
+		*ecc_code++ = val0;
+	} else {
+		*ecc_code++ = val1 >> 12;
+		*ecc_code++ = val1 >> 4;
+		*ecc_code++ = ((val1 & 0xf) << 4) | ((val0 >> 28) & 0xf);
+		*ecc_code++ = val0 >> 20;
+		*ecc_code++ = val0 >> 12;
+		*ecc_code++ = val0 >> 4;
+		*ecc_code++ = (val0 & 0xf) << 4;
+	}
+
+	return 0;
+}
+
+/*
+ * omap_correct_data_bch - correct up to bch_t bit flips in a sector
+ * @mtd: MTD device structure
+ * @dat: page data
+ * @read_ecc: ecc read from nand flash
+ * @calc_ecc: ecc read from HW ECC registers
+ */
+static int omap_correct_data_bch(struct mtd_info *mtd, u_char *dat,
+				 u_char *read_ecc, u_char *calc_ecc)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+							mtd);
+	unsigned int err_loc[OMAP_BCH_MAX_T];
+	int i, count;
+
+	/* an erased sector has no parity to check against */
+	for (i = 0; i < info->nand.ecc.bytes; i++)
+		if (read_ecc[i] != 0xff)
+			break;
+	if (i == info->nand.ecc.bytes)
+		return 0;
+
+	count = omap_bch_decode(info->bch_t, read_ecc, calc_ecc,
+				info->nand.ecc.size, err_loc);
+	if (count < 0) {
+		DEBUG(MTD_DEBUG_LEVEL0, "BCH: uncorrectable error\n");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		dat[err_loc[i] >> 3] ^= 1 << (err_loc[i] & 7);
+
+	return count;
+}
+
+/*
+ * omap_bch_init - switch the chip over to BCH
+ * @info: NAND device
+ * @ecc_opt: OMAP_ECC_BCH4_CODE_HW or OMAP_ECC_BCH8_CODE_HW
+ */
+static void omap_bch_init(struct omap_nand_info *info, int ecc_opt)
+{
+	info->bch_t = (ecc_opt == OMAP_ECC_BCH8_CODE_HW) ? 8 : 4;
+	info->nand.ecc.bytes		= OMAP_BCH_ECC_BYTES(info->bch_t);
+	info->nand.ecc.size		= 512;
+	info->nand.ecc.calculate	= omap_calculate_ecc_bch;
+	info->nand.ecc.hwctl		= omap_enable_hwecc_bch;
+	info->nand.ecc.correct		= omap_correct_data_bch;
+	info->nand.ecc.mode		= NAND_ECC_HW;
+}
+
+/*
+ * omap_bch_layout - place the BCH parity at the end of the spare area
+ * @info: NAND device, identified but not yet through nand_scan_tail()
+ *
+ * nand_base only has layouts for 3 ecc bytes per 256/512 bytes, keep
+ * the bad block marker and use whatever is left in between as free oob.
+ */
+static int omap_bch_layout(struct omap_nand_info *info)
+{
+	struct mtd_info *mtd = &info->mtd;
+	struct nand_ecclayout *layout = &info->ecclayout;
+	int i, offset;
+
+	layout->eccbytes = (mtd->writesize / info->nand.ecc.size) *
+			   info->nand.ecc.bytes;
+	if (mtd->writesize < 2048 ||
+	    layout->eccbytes > ARRAY_SIZE(layout->eccpos) ||
+	    layout->eccbytes + 2 > mtd->oobsize) {
+		dev_err(&info->pdev->dev, "BCH%d doesn't fit a %d+%d page\n",
+			info->bch_t, mtd->writesize, mtd->oobsize);
+		return -EINVAL;
+	}
+
+	offset = mtd->oobsize - layout->eccbytes;
+	for (i = 0; i < layout->eccbytes; i++)
+		layout->eccpos[i] = offset + i;
+	layout->oobfree[0].offset = 2;
+	layout->oobfree[0].length = offset - 2;
+	info->nand.ecc.layout = layout;
+
+	return 0;
+}
+#endif
+
 /*
  * omap_wait - Wait function is called during Program and erase
  * operations and the way it is called from MTD layer, we should wait
@@ -488,6 +1008,8 @@ static int __devinit omap_nand_probe(struct platform_device *pdev)
 
 	info->nand.IO_ADDR_W = info->nand.IO_ADDR_R;
 	info->nand.cmd_ctrl  = omap_hwcontrol;
+	info->pref_fifo = info->nand.IO_ADDR_R;
+	info->dma_ch = -1;
 
 	/* REVISIT:  only supports 16-bit NAND flash */
 
@@ -495,6 +1017,30 @@ static int __devinit omap_nand_probe(struct platform_device *pdev)
 	info->nand.write_buf  = omap_write_buf16;
 	info->nand.verify_buf = omap_verify_buf;
 
+#ifdef CONFIG_MTD_NAND_OMAP_PREFETCH
+	if (use_prefetch) {
+		info->nand.read_buf   = omap_read_buf_pref;
+		info->nand.write_buf  = omap_write_buf_pref;
+		if (use_dma) {
+			err = omap_request_dma(OMAP24XX_DMA_GPMC, "NAND",
+					omap_nand_dma_cb, &info->comp,
+					&info->dma_ch);
+			if (err < 0) {
+				info->dma_ch = -1;
+				dev_warn(&pdev->dev, "DMA request failed,"
+					" using MPU prefetch\n");
+			} else {
+				omap_set_dma_dest_burst_mode(info->dma_ch,
+						OMAP_DMA_DATA_BURST_16);
+				omap_set_dma_src_burst_mode(info->dma_ch,
+						OMAP_DMA_DATA_BURST_16);
+				info->nand.read_buf   = omap_read_buf_dma_pref;
+				info->nand.write_buf  = omap_write_buf_dma_pref;
+			}
+		}
+	}
+#endif
+
 	/*
 	* If RDY/BSY line is connected to OMAP then use the omap ready funcrtion
 	* and the generic nand_wait function which reads the status register
@@ -529,18 +1075,45 @@ static int __devinit omap_nand_probe(struct platform_device *pdev)
 	info->nand.ecc.mode = NAND_ECC_SOFT;
 	info->nand.ecc.size		= 512;
 #endif
+#ifdef CONFIG_MTD_NAND_OMAP_BCH
+	if (pdata->ecc_opt == OMAP_ECC_BCH4_CODE_HW ||
+	    pdata->ecc_opt == OMAP_ECC_BCH8_CODE_HW)
+		omap_bch_init(info, pdata->ecc_opt);
+#endif
 
 	/* DIP switches on some boards change between 8 and 16 bit
 	 * bus widths for flash.  Try the other width if the first try fails.
 	 */
-	if (nand_scan(&info->mtd, 1)) {
+	if (nand_scan_ident(&info->mtd, 1)) {
 		info->nand.options ^= NAND_BUSWIDTH_16;
-		if (nand_scan(&info->mtd, 1)) {
+		if (nand_scan_ident(&info->mtd, 1)) {
 			err = -ENXIO;
-			goto out_release_mem_region;
+			goto out_free_dma;
 		}
 	}
 
+#ifdef CONFIG_MTD_NAND_OMAP_BCH
+	/* the BCH layout depends on the page geometry found above */
+	if (info->bch_t) {
+		err = omap_bch_layout(info);
+		if (err)
+			goto out_free_dma;
+	}
+#endif
+
+#ifdef CONFIG_MTD_NAND_OMAP_PREFETCH
+	/* nand_scan_ident() filled in the default wait function */
+	if (use_prefetch) {
+		info->waitfunc = info->nand.waitfunc;
+		info->nand.waitfunc = omap_wait_xfer;
+	}
+#endif
+
+	if (nand_scan_tail(&info->mtd)) {
+		err = -ENXIO;
+		goto out_free_dma;
+	}
+
 #ifdef CONFIG_MTD_PARTITIONS
 	err = parse_mtd_partitions(&info->mtd, part_probes, &info->parts, 0);
 	if (err > 0)
@@ -555,6 +1128,9 @@ static int __devinit omap_nand_probe(struct platform_device *pdev)
 
 	return 0;
 
+out_free_dma:
+	if (info->dma_ch >= 0)
+		omap_free_dma(info->dma_ch);
 out_release_mem_region:
 	release_mem_region(info->phys_base, NAND_IO_SIZE);
 out_free_cs:
@@ -568,9 +1144,12 @@ out_free_info:
 static int omap_nand_remove(struct platform_device *pdev)
 {
 	struct mtd_info *mtd = platform_get_drvdata(pdev);
-	struct omap_nand_info *info = mtd->priv;
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+							mtd);
 
 	platform_set_drvdata(pdev, NULL);
+	if (info->dma_ch >= 0)
+		omap_free_dma(info->dma_ch);
 	/* Release NAND device, its internal structures and partitions */
 	nand_release(&info->mtd);
 	iounmap(info->nand.IO_ADDR_R);
@@ -0,0 +1,225 @@
+/*
+ * drivers/mtd/nand/omap_bch_decoder.c
+ *
+ * BCH error locator for the OMAP GPMC 4-bit and 8-bit BCH ECC engine.
+ *
+ * The GPMC engine only generates the parity of each 512 byte sector,
+ * finding and correcting the bit errors is left to software. The code
+ * is a binary BCH code over GF(2^13), shortened to the sector size.
+ *
+ * Bit numbering follows the engine: the first data byte carries the
+ * highest degree coefficients, most significant bit first, and the
+ * parity is stored left justified, with x^0 in the last ecc byte.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/string.h>
+
+#include "omap_bch_decoder.h"
+
+#define GF_M		13
+#define GF_N		((1 << GF_M) - 1)	/* 8191 */
+#define GF_POLY		0x201b			/* x^13 + x^4 + x^3 + x + 1 */
+
+/* alpha^i for 0 <= i < GF_N, and its inverse */
+static u16 gf_exp[GF_N];
+static u16 gf_log[GF_N + 1];
+
+static inline unsigned int gf_mod(unsigned int i)
+{
+	while (i >= GF_N)
+		i -= GF_N;
+	return i;
+}
+
+static inline u16 gf_mul(u16 a, u16 b)
+{
+	if (!a || !b)
+		return 0;
+	return gf_exp[gf_mod(gf_log[a] + gf_log[b])];
+}
+
+static inline u16 gf_div(u16 a, u16 b)
+{
+	if (!a)
+		return 0;
+	return gf_exp[gf_mod(gf_log[a] + GF_N - gf_log[b])];
+}
+
+/* alpha^(i * j), i and j already reduced */
+static inline u16 gf_pow(unsigned int i, unsigned int j)
+{
+	return gf_exp[(i * j) % GF_N];
+}
+
+/*
+ * bch_syndromes - evaluate the parity difference at alpha^1..alpha^2t
+ *
+ * The xor of the stored and the recomputed parity is the remainder of
+ * the received codeword modulo the generator polynomial, and the
+ * generator vanishes at alpha^1..alpha^2t, so evaluating the remainder
+ * there gives the syndromes of the whole codeword.
+ */
+static int bch_syndromes(int t, const u8 *read_ecc, const u8 *calc_ecc,
+			 u16 *syn)
+{
+	int nbytes = OMAP_BCH_ECC_BYTES(t);
+	int pad = nbytes * 8 - OMAP_BCH_PARITY_BITS(t);
+	int i, j, b, pos, nonzero = 0;
+	u8 diff;
+
+	memset(syn, 0, sizeof(u16) * (2 * t + 1));
+	for (i = 0; i < nbytes; i++) {
+		diff = read_ecc[i] ^ calc_ecc[i];
+		if (!diff)
+			continue;
+		nonzero = 1;
+		for (b = 0; b < 8; b++) {
+			if (!(diff & (1 << b)))
+				continue;
+			pos = (nbytes - 1 - i) * 8 + b - pad;
+			if (pos < 0)
+				continue;
+			/* only odd syndromes, S(2j) = S(j)^2 in GF(2^m) */
+			for (j = 1; j <= 2 * t; j += 2)
+				syn[j] ^= gf_pow(pos, j);
+		}
+	}
+	for (j = 2; j <= 2 * t; j += 2)
+		syn[j] = gf_mul(syn[j / 2], syn[j / 2]);
+
+	return nonzero;
+}
+
+/*
+ * bch_locator - Berlekamp-Massey, returns the degree of the error
+ * locator polynomial left in @lambda
+ */
+static int bch_locator(int t, const u16 *syn, u16 *lambda)
+{
+	u16 prev[2 * OMAP_BCH_MAX_T + 1], tmp[2 * OMAP_BCH_MAX_T + 1];
+	u16 d, b = 1, coef;
+	int n, i, l = 0, m = 1;
+
+	memset(lambda, 0, sizeof(tmp));
+	memset(prev, 0, sizeof(prev));
+	lambda[0] = prev[0] = 1;
+
+	for (n = 0; n < 2 * t; n++) {
+		/* discrepancy */
+		d = syn[n + 1];
+		for (i = 1; i <= l; i++)
+			d ^= gf_mul(lambda[i], syn[n + 1 - i]);
+
+		if (!d) {
+			m++;
+			continue;
+		}
+
+		coef = gf_div(d, b);
+		memcpy(tmp, lambda, sizeof(tmp));
+		for (i = 0; i + m <= 2 * t; i++)
+			lambda[i + m] ^= gf_mul(coef, prev[i]);
+
+		if (2 * l <= n) {
+			l = n + 1 - l;
+			memcpy(prev, tmp, sizeof(prev));
+			b = d;
+			m = 1;
+		} else {
+			m++;
+		}
+	}
+	return l;
+}
+
+/**
+ * omap_bch_decode - locate the bit errors of one BCH protected sector
+ * @t: correction capability, 4 or 8
+ * @read_ecc: parity read back from the spare area
+ * @calc_ecc: parity the engine computed over the data just read
+ * @len: sector size in bytes
+ * @err_loc: filled with the (byte << 3 | bit) offsets of the data bits
+ *	     to flip, room for @t entries
+ *
+ * Returns the number of entries written to @err_loc, or -1 when there
+ * are more errors than the code can correct. Errors in the parity
+ * itself are located but not reported.
+ */
+int omap_bch_decode(int t, const u8 *read_ecc, const u8 *calc_ecc,
+		    int len, unsigned int *err_loc)
+{
+	u16 syn[2 * OMAP_BCH_MAX_T + 1];
+	u16 lambda[2 * OMAP_BCH_MAX_T + 1];
+	u16 term[2 * OMAP_BCH_MAX_T + 1];
+	int parity_bits = OMAP_BCH_PARITY_BITS(t);
+	int nbits = len * 8 + parity_bits;
+	int deg, pos, i, found = 0, count = 0;
+	u16 sum;
+
+	if (t > OMAP_BCH_MAX_T || nbits > GF_N)
+		return -1;
+
+	if (!bch_syndromes(t, read_ecc, calc_ecc, syn))
+		return 0;
+
+	deg = bch_locator(t, syn, lambda);
+	if (deg > t)
+		return -1;
+
+	/*
+	 * Chien search over the shortened code: an error at bit position
+	 * pos makes lambda vanish at alpha^-pos. term[i] walks
+	 * lambda[i] * alpha^(-i * pos) one position at a time.
+	 */
+	for (i = 1; i <= deg; i++)
+		term[i] = lambda[i];
+	for (pos = 0; pos < nbits && found < deg; pos++) {
+		sum = lambda[0];
+		for (i = 1; i <= deg; i++)
+			sum ^= term[i];
+		if (!sum) {
+			found++;
+			if (pos >= parity_bits) {
+				int bit = pos - parity_bits;
+
+				err_loc[count++] = ((len - 1 - (bit >> 3)) << 3) |
+						   (bit & 7);
+			}
+		}
+		for (i = 1; i <= deg; i++)
+			term[i] = gf_mul(term[i], gf_exp[GF_N - i]);
+	}
+
+	/* roots outside the sector: too many errors to tell */
+	if (found != deg)
+		return -1;
+
+	return count;
+}
+EXPORT_SYMBOL(omap_bch_decode);
+
+static int __init omap_bch_decoder_init(void)
+{
+	unsigned int i, x = 1;
+
+	for (i = 0; i < GF_N; i++) {
+		gf_exp[i] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & (1 << GF_M))
+			x ^= GF_POLY;
+	}
+	gf_log[0] = 0;
+	return 0;
+}
+subsys_initcall(omap_bch_decoder_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BCH error locator for the OMAP GPMC ECC engine");
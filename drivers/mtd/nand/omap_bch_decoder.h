@@ -0,0 +1,20 @@
+/*
+ * drivers/mtd/nand/omap_bch_decoder.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __OMAP_BCH_DECODER_H
+#define __OMAP_BCH_DECODER_H
+
+#define OMAP_BCH_MAX_T		8
+/* 13 parity bits per correctable error, stored in whole bytes */
+#define OMAP_BCH_PARITY_BITS(t)	(13 * (t))
+#define OMAP_BCH_ECC_BYTES(t)	((OMAP_BCH_PARITY_BITS(t) + 7) / 8)
+
+extern int omap_bch_decode(int t, const u8 *read_ecc, const u8 *calc_ecc,
+			   int len, unsigned int *err_loc);
+
+#endif
@@ -64,6 +64,7 @@ static struct platform_device *alarm_platform_dev;
 static struct hrtimer alarm_timer[ANDROID_ALARM_TYPE_COUNT];
 static struct timespec alarm_time[ANDROID_ALARM_TYPE_COUNT];
 static struct timespec elapsed_rtc_delta;
+static LIST_HEAD(alarm_kernel_wakeups);
 
 static void alarm_start_hrtimer(enum android_alarm_type alarm_type)
 {
@@ -292,6 +293,39 @@ static int alarm_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/**
+ * android_alarm_wakeup_set - keep an rtc wakeup armed for a kernel client
+ * @w: wakeup, initialized with android_alarm_wakeup_init()
+ * @expires: CLOCK_REALTIME time to resume by
+ *
+ * Replaces the previous expiry of @w.  May be called from any context.
+ */
+void android_alarm_wakeup_set(struct android_alarm_wakeup *w,
+			      struct timespec expires)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&alarm_slock, flags);
+	w->expires = expires;
+	list_move_tail(&w->entry, &alarm_kernel_wakeups);
+	spin_unlock_irqrestore(&alarm_slock, flags);
+}
+EXPORT_SYMBOL_GPL(android_alarm_wakeup_set);
+
+/**
+ * android_alarm_wakeup_cancel - stop waking the system for @w
+ * @w: wakeup, initialized with android_alarm_wakeup_init()
+ */
+void android_alarm_wakeup_cancel(struct android_alarm_wakeup *w)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&alarm_slock, flags);
+	list_del_init(&w->entry);
+	spin_unlock_irqrestore(&alarm_slock, flags);
+}
+EXPORT_SYMBOL_GPL(android_alarm_wakeup_cancel);
+
 static enum hrtimer_restart alarm_timer_triggered(struct hrtimer *timer)
 {
 	unsigned long flags;
@@ -332,6 +366,7 @@ int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 	struct timespec     rtc_current_timespec;
 	struct timespec     rtc_delta;
 	struct timespec     elapsed_realtime_alarm_time;
+	struct android_alarm_wakeup *w;
 
 	ANDROID_ALARM_DPRINTF(ANDROID_ALARM_PRINT_FLOW,
 			      "alarm_suspend(%p, %d)\n", pdev, state.event);
@@ -342,7 +377,8 @@ int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 		err = -EBUSY;
 		goto err1;
 	}
-	if (alarm_enabled & ANDROID_ALARM_WAKEUP_MASK) {
+	if ((alarm_enabled & ANDROID_ALARM_WAKEUP_MASK) ||
+	    !list_empty(&alarm_kernel_wakeups)) {
 		spin_unlock_irqrestore(&alarm_slock, flags);
 		if (alarm_enabled & ANDROID_ALARM_RTC_WAKEUP_MASK)
 			hrtimer_cancel(&alarm_timer[ANDROID_ALARM_RTC_WAKEUP]);
@@ -368,9 +404,20 @@ int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 			rtc_alarm_time = timespec_sub(
 					alarm_time[ANDROID_ALARM_RTC_WAKEUP],
 					rtc_delta).tv_sec;
-		else
+		else if (alarm_enabled &
+			 ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP_MASK)
 			rtc_alarm_time = timespec_sub(
 				elapsed_realtime_alarm_time, rtc_delta).tv_sec;
+		else
+			rtc_alarm_time = ULONG_MAX;
+		spin_lock_irqsave(&alarm_slock, flags);
+		list_for_each_entry(w, &alarm_kernel_wakeups, entry) {
+			unsigned long t = timespec_sub(w->expires,
+						       rtc_delta).tv_sec;
+			if (t < rtc_alarm_time)
+				rtc_alarm_time = t;
+		}
+		spin_unlock_irqrestore(&alarm_slock, flags);
 		rtc_time_to_tm(rtc_alarm_time, &rtc_alarm.time);
 		rtc_alarm.enabled = 1;
 		rtc_set_alarm(alarm_rtc_dev, &rtc_alarm);
@@ -407,7 +454,8 @@ int alarm_resume(struct platform_device *pdev)
 	struct rtc_wkalrm alarm;
 	ANDROID_ALARM_DPRINTF(ANDROID_ALARM_PRINT_FLOW,
 			      "alarm_resume(%p)\n", pdev);
-	if (alarm_enabled & ANDROID_ALARM_WAKEUP_MASK) {
+	if ((alarm_enabled & ANDROID_ALARM_WAKEUP_MASK) ||
+	    !list_empty(&alarm_kernel_wakeups)) {
 		memset(&alarm, 0, sizeof(alarm));
 		alarm.enabled = 0;
 		rtc_set_alarm(alarm_rtc_dev, &alarm);
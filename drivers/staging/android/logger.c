@@ -23,42 +23,114 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/rwsem.h>
+#include <linux/ctype.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_ring - the buffer of a log, and where we are in it
+ *
+ * Writers do not lock: each one reserves room for its entry by advancing
+ * 'w_pos' atomically, copies the entry in and then commits it by storing the
+ * entry's position in the sequence word in front of it.  Positions count
+ * bytes written since the log was created and only their low bits index the
+ * ring, so a reader can tell from 'w_pos' alone whether it has been lapped,
+ * and from the sequence word whether the entry under it is complete.  The
+ * entry layout is described in logger.h, as mmap() exposes it.
+ *
+ * A ring is replaced as a whole when the log is resized.
+ */
+struct logger_ring {
+	unsigned char *		buffer;	/* the ring buffer itself */
+	size_t *		chunk;	/* first entry of each chunk */
+	atomic_long_t		w_pos;	/* next position to reserve */
+	size_t			head;	/* new readers start here */
+	size_t			size;	/* size of the log */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
- * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * This structure lives from its creation until module removal, so it does
+ * not need additional reference counting.  Writers find the current ring
+ * with preemption disabled; everybody else holds 'ring_sem' for reading,
+ * and resizing holds it for writing.
  */
 struct logger_log {
-	unsigned char *		buffer;	/* the ring buffer itself */
+	struct logger_ring *	ring;	/* the current buffer */
+	struct rw_semaphore	ring_sem; /* pins 'ring' for readers */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
-	size_t			size;	/* size of the log */
+	clockid_t		clock;	/* stamp entries by this clock */
+	atomic_t		mapped;	/* mmap()s of the ring */
+	struct list_head	list;	/* entry in logger_logs */
+	char			name[sizeof("log_") + LOGGER_NAME_LEN];
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by its mutex, which only
+ * serializes readers sharing the file and nests inside log->ring_sem.
+ *
+ * read() copies entries into 'bounce' under log->ring_sem and hands them to
+ * user space after dropping it: a faulting copy_to_user() takes mmap_sem,
+ * which logger_mmap() holds while it takes log->ring_sem.
  */
 struct logger_reader {
 	struct logger_log *	log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* protects r_off and bounce */
+	size_t			r_off;	/* position of the next entry */
+	int			batch;	/* read() as many entries as fit */
+	unsigned char		bounce[LOGGER_ENTRY_MAX_LEN];
 };
 
-/* logger_offset - returns index 'n' into the log via (optimized) modulus */
-#define logger_offset(n)	((n) & (log->size - 1))
+/*
+ * The ring is divided into chunks of LOGGER_CHUNK bytes, and ring->chunk
+ * remembers where the first entry starting in each chunk was put.  Lapped
+ * readers use it to find an entry boundary again, see logger_resync().
+ */
+#define LOGGER_CHUNK_SHIFT	9
+#define LOGGER_CHUNK		(1 << LOGGER_CHUNK_SHIFT)
+#define logger_chunk(pos)	\
+	(((pos) >> LOGGER_CHUNK_SHIFT) & ((ring->size >> LOGGER_CHUNK_SHIFT) - 1))
+
+/* logger_offset - returns index 'n' into the ring via (optimized) modulus */
+#define logger_offset(n)	((n) & (ring->size - 1))
+
+/*
+ * Log sizes are powers of two between these; the default ones can be set
+ * with the parameters below, and any log resized with
+ * LOGGER_SET_LOG_BUF_SIZE.
+ */
+#define LOGGER_MIN_SIZE		(2 * LOGGER_ENTRY_MAX_LEN)
+#define LOGGER_MAX_SIZE		(16 * 1024 * 1024)
+#define LOGGER_MAX_LOGS		16
+
+static unsigned long logger_main_size = 64 * 1024;
+module_param_named(main_size, logger_main_size, ulong, S_IRUGO);
+static unsigned long logger_events_size = 256 * 1024;
+module_param_named(events_size, logger_events_size, ulong, S_IRUGO);
+static unsigned long logger_radio_size = 64 * 1024;
+module_param_named(radio_size, logger_radio_size, ulong, S_IRUGO);
+
+/* all logs, protected by logger_logs_lock */
+static LIST_HEAD(logger_logs);
+static DEFINE_MUTEX(logger_logs_lock);
+
+/*
+ * Writers gather the payload here before reserving any room, so that the
+ * ring is only touched with preemption disabled and no page faults pending.
+ */
+static DEFINE_PER_CPU(unsigned char [LOGGER_ENTRY_MAX_PAYLOAD], logger_stage);
 
 /*
  * file_get_log - Given a file structure, return the associated log
@@ -84,58 +156,141 @@ static inline struct logger_log * file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * logger_copy_out - copies 'count' bytes at position 'pos' out of the ring
+ */
+static void logger_copy_out(struct logger_ring *ring, size_t pos,
+			    void *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len = min(count, ring->size - off);
+
+	memcpy(buf, ring->buffer + off, len);
+	if (count != len)
+		memcpy(buf + len, ring->buffer, count - len);
+}
+
+/*
+ * logger_copy_in - copies 'count' bytes from 'buf' into the ring at
+ * position 'pos'
+ */
+static void logger_copy_in(struct logger_ring *ring, size_t pos,
+			   const void *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len = min(count, ring->size - off);
+
+	memcpy(ring->buffer + off, buf, len);
+	if (count != len)
+		memcpy(ring->buffer, buf + len, count - len);
+}
+
+static inline __u32 logger_seq(struct logger_ring *ring, size_t pos)
+{
+	return ACCESS_ONCE(*(__u32 *) (ring->buffer + logger_offset(pos)));
+}
+
+/*
+ * logger_lapped - have writers reserved over the position 'pos' yet?
+ */
+static inline int logger_lapped(struct logger_ring *ring, size_t pos)
+{
+	return (size_t) atomic_long_read(&ring->w_pos) - pos > ring->size;
+}
+
+/*
+ * logger_resync - returns the position of the oldest entry we can still find
+ * in 'ring', given the write position 'w'.
  *
- * Caller needs to hold log->mutex.
+ * Everything from w - size on is intact, but entries are of variable length,
+ * so we go by chunk: the first chunk after that whose entry was recorded in
+ * this lap gives a boundary.  A few entries at the start of the ring may be
+ * skipped this way, which beats walking entries that are being overwritten.
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static size_t logger_resync(struct logger_ring *ring, size_t w)
 {
-	__u16 val;
+	size_t base = ALIGN(w - ring->size, LOGGER_CHUNK);
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
+	for (; (long) (w - base) > 0; base += LOGGER_CHUNK) {
+		size_t first = ACCESS_ONCE(ring->chunk[logger_chunk(base)]);
+
+		if (first - base < LOGGER_CHUNK && (long) (w - first) >= 0)
+			return first;
 	}
 
-	return sizeof(struct logger_entry) + val;
+	return w;
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * logger_peek - copies the header of the reader's next entry to 'entry'.
+ * Readers that were flushed or lapped are moved forward first.
+ *
+ * Returns 1 if there is a committed entry at reader->r_off, 0 if the reader
+ * is caught up or the next entry is still being written.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->ring_sem for reading and reader->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static int logger_peek(struct logger_log *log, struct logger_reader *reader,
+		       struct logger_entry *entry)
 {
-	size_t len;
+	struct logger_ring *ring = log->ring;
+	size_t w, pos;
+
+again:
+	w = atomic_long_read(&ring->w_pos);
+	pos = reader->r_off;
+	if ((long) (ACCESS_ONCE(ring->head) - pos) > 0)
+		pos = ACCESS_ONCE(ring->head);
+	if (w - pos > ring->size)
+		pos = logger_resync(ring, w);
+	reader->r_off = pos;
+
+	if (pos == w)
+		return 0;
 
-	/*
-	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	if (logger_seq(ring, pos) != (__u32) pos) {
+		if (logger_lapped(ring, pos))
+			goto again;
+		return 0;
+	}
+	smp_rmb();
+	logger_copy_out(ring, pos + sizeof(__u32), entry, sizeof(*entry));
+	smp_rmb();
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+	/* overwritten while we looked? */
+	if (logger_seq(ring, pos) != (__u32) pos || logger_lapped(ring, pos))
+		goto again;
 
-	reader->r_off = logger_offset(reader->r_off + count);
+	/* only a torn entry could look like this; skip what we have */
+	if (unlikely(entry->len > LOGGER_ENTRY_MAX_PAYLOAD)) {
+		reader->r_off = w;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * do_read_log - copies the entry at reader->r_off, whose header is 'entry',
+ * into 'buf' and moves the reader past it. Returns the number of bytes
+ * copied, or 0 if the entry was overwritten while we copied it.
+ *
+ * Caller must hold log->ring_sem for reading and reader->mutex.
+ */
+static size_t do_read_log(struct logger_ring *ring,
+			  struct logger_reader *reader,
+			  struct logger_entry *entry,
+			  unsigned char *buf)
+{
+	size_t count = sizeof(struct logger_entry) + entry->len;
+
+	logger_copy_out(ring, reader->r_off + sizeof(__u32), buf, count);
+
+	/* make sure writers left us alone while we copied */
+	smp_rmb();
+	if (logger_lapped(ring, reader->r_off))
+		return 0;
+
+	reader->r_off += LOGGER_REC_LEN(entry->len);
 
 	return count;
 }
@@ -147,7 +302,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or after LOGGER_SET_BATCH_READ
+ * 	  as many whole entries as fit
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -157,6 +313,8 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry entry;
+	size_t total, len, n, start;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -164,9 +322,11 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		down_read(&log->ring_sem);
+		mutex_lock(&reader->mutex);
+		ret = !logger_peek(log, reader, &entry);
+		mutex_unlock(&reader->mutex);
+		up_read(&log->ring_sem);
 		if (!ret)
 			break;
 
@@ -187,131 +347,120 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	/*
+	 * Gather whole entries into the bounce buffer while they fit, and copy
+	 * them out once log->ring_sem is dropped.  do_read_log() returns 0 for
+	 * an entry overwritten under us, which logger_peek() then skips.  A
+	 * failed copy puts the reader back, as reader->mutex is still held.
+	 */
+	total = 0;
+	do {
+		down_read(&log->ring_sem);
+		mutex_lock(&reader->mutex);
+
+		start = reader->r_off;
+		len = 0;
+		while (logger_peek(log, reader, &entry)) {
+			n = sizeof(struct logger_entry) + entry.len;
+			if (count - total - len < n) {
+				if (!total && !len)
+					ret = -EINVAL;
+				break;
+			}
+			if (len + n > sizeof(reader->bounce))
+				break;
+			len += do_read_log(log->ring, reader, &entry,
+					   reader->bounce + len);
+			if (len && !reader->batch)
+				break;
+		}
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+		up_read(&log->ring_sem);
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
+		if (len && copy_to_user(buf + total, reader->bounce, len)) {
+			reader->r_off = start;
+			ret = -EFAULT;
+			len = 0;
+		}
+		mutex_unlock(&reader->mutex);
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+		total += len;
+	} while (len && reader->batch);
 
-out:
-	mutex_unlock(&log->mutex);
+	if (total)
+		return total;
+	if (ret < 0)
+		return ret;
 
-	return ret;
+	/* we raced, or were lapped while copying */
+	goto start;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_copy_iov - gathers 'len' bytes of payload from the user-space
+ * vectors 'iov' into 'dst'.
  *
- * Caller must hold log->mutex.
+ * With 'atomic' set no page faults are taken, and a failure may just mean
+ * that the caller has to retry where it can sleep.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static int logger_copy_iov(void *dst, const struct iovec *iov,
+			   unsigned long nr_segs, size_t len, int atomic)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+	while (len && nr_segs--) {
+		size_t n = min_t(size_t, iov->iov_len, len);
+		unsigned long left;
+
+		if (atomic) {
+			if (!access_ok(VERIFY_READ, iov->iov_base, n))
+				return -EFAULT;
+			pagefault_disable();
+			left = __copy_from_user_inatomic(dst, iov->iov_base, n);
+			pagefault_enable();
+		} else
+			left = copy_from_user(dst, iov->iov_base, n);
+		if (left)
+			return -EFAULT;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+		dst += n;
+		len -= n;
+		iov++;
 	}
 
 	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * do_write_log - reserves room for 'header' and its payload in the ring of
+ * 'log', copies them in and commits the entry.
  *
- * The caller needs to hold log->mutex.
+ * Called with preemption disabled, which keeps the time between reserving
+ * and committing short (readers wait for an uncommitted entry in front of
+ * them) and keeps the ring from being freed under us by a resize.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void do_write_log(struct logger_log *log,
+			 const struct logger_entry *header, const void *payload)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
-}
-
-/*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
- */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
-}
-
-/*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
- */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
+	struct logger_ring *ring = ACCESS_ONCE(log->ring);
+	size_t len = LOGGER_REC_LEN(header->len);
+	size_t pos, end;
+	__u32 *seq;
+
+	smp_read_barrier_depends();
+	pos = atomic_long_add_return(len, &ring->w_pos) - len;
+	end = pos + len;
+	seq = (__u32 *) (ring->buffer + logger_offset(pos));
+
+	/* we are the entry before the first one in the next chunk */
+	if ((pos >> LOGGER_CHUNK_SHIFT) != (end >> LOGGER_CHUNK_SHIFT))
+		ring->chunk[logger_chunk(end)] = end;
+
+	ACCESS_ONCE(*seq) = LOGGER_SEQ_BUSY;
+	smp_wmb();
+	logger_copy_in(ring, pos + sizeof(__u32), header, sizeof(*header));
+	logger_copy_in(ring, pos + sizeof(__u32) + sizeof(*header), payload,
+		       header->len);
+	smp_wmb();
+	ACCESS_ONCE(*seq) = pos;
 }
 
 /*
@@ -323,13 +472,16 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	void *payload;
 
-	now = current_kernel_time();
+	if (ACCESS_ONCE(log->clock) == CLOCK_MONOTONIC)
+		ktime_get_ts(&now);
+	else
+		now = current_kernel_time();
 
+	header.__pad = 0;
 	header.pid = current->tgid;
 	header.tid = current->pid;
 	header.sec = now.tv_sec;
@@ -340,43 +492,35 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * Usually the payload is resident and goes straight into this cpu's
+	 * staging buffer.  If not, fault it into a bounce buffer instead.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	payload = get_cpu_var(logger_stage);
+	if (unlikely(logger_copy_iov(payload, iov, nr_segs, header.len, 1))) {
+		void *bounce;
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		put_cpu_var(logger_stage);
+		bounce = kmalloc(header.len, GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+		if (logger_copy_iov(bounce, iov, nr_segs, header.len, 0)) {
+			kfree(bounce);
+			return -EFAULT;
 		}
-
-		iov++;
-		ret += nr;
+		preempt_disable();
+		do_write_log(log, &header, bounce);
+		preempt_enable();
+		kfree(bounce);
+	} else {
+		do_write_log(log, &header, payload);
+		put_cpu_var(logger_stage);
 	}
 
-	mutex_unlock(&log->mutex);
-
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
-	return ret;
+	return header.len;
 }
 
 static struct logger_log * get_log_from_minor(int);
@@ -407,12 +551,11 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		down_read(&log->ring_sem);
+		reader->r_off = log->ring->head;
+		up_read(&log->ring_sem);
+		reader->batch = 0;
 
 		file->private_data = reader;
 	} else
@@ -430,7 +573,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -450,6 +592,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 {
 	struct logger_reader *reader;
 	struct logger_log *log;
+	struct logger_entry entry;
 	unsigned int ret = POLLOUT | POLLWRNORM;
 
 	if (!(file->f_mode & FMODE_READ))
@@ -460,25 +603,123 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	down_read(&log->ring_sem);
+	mutex_lock(&reader->mutex);
+	if (logger_peek(log, reader, &entry))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
+	up_read(&log->ring_sem);
+
+	return ret;
+}
+
+static struct logger_ring *logger_alloc_ring(size_t size, size_t start);
+static void logger_free_ring(struct logger_ring *ring);
+static struct logger_log *logger_create_log(const char *name,
+					    unsigned long size);
+
+/*
+ * logger_set_size - replaces the ring of 'log' by an empty one of 'size'
+ * bytes.  Readers carry on with the new ring, from where the old one ended.
+ */
+static long logger_set_size(struct logger_log *log, unsigned long size)
+{
+	struct logger_ring *ring, *old;
+	long ret = 0;
+
+	if (size < LOGGER_MIN_SIZE || size > LOGGER_MAX_SIZE)
+		return -EINVAL;
+
+	down_write(&log->ring_sem);
+
+	/* a mapping would keep the old buffer alive */
+	if (atomic_read(&log->mapped)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	/* no reader can be past the old write position while we hold this */
+	old = log->ring;
+	ring = logger_alloc_ring(roundup_pow_of_two(size),
+				 atomic_long_read(&old->w_pos));
+	if (!ring) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	smp_wmb();
+	log->ring = ring;
+	up_write(&log->ring_sem);
 
+	/* writers run with preemption disabled */
+	synchronize_sched();
+	logger_free_ring(old);
+
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, (unsigned long) ring->size >> 10);
+	return 0;
+
+out:
+	up_write(&log->ring_sem);
 	return ret;
 }
 
+/*
+ * logger_new_log - creates a log for LOGGER_NEW_LOG
+ */
+static long logger_new_log(void __user *arg)
+{
+	struct logger_new_log req;
+	char name[sizeof("log_") + LOGGER_NAME_LEN];
+	struct logger_log *log;
+	int i;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	if (!req.name[0] || !memchr(req.name, '\0', sizeof(req.name)))
+		return -EINVAL;
+	for (i = 0; req.name[i]; i++)
+		if (!isalnum(req.name[i]) && req.name[i] != '_')
+			return -EINVAL;
+	if (req.size < LOGGER_MIN_SIZE || req.size > LOGGER_MAX_SIZE)
+		return -EINVAL;
+
+	snprintf(name, sizeof(name), "log_%s", req.name);
+	log = logger_create_log(name, req.size);
+	if (IS_ERR(log))
+		return PTR_ERR(log);
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry entry;
+	struct logger_ring *ring;
 	long ret = -ENOTTY;
+	size_t len;
+	__u32 pos = 0;
 
-	mutex_lock(&log->mutex);
+	switch (cmd) {
+	case LOGGER_SET_LOG_BUF_SIZE:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return logger_set_size(log, arg);
+	case LOGGER_NEW_LOG:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return logger_new_log((void __user *) arg);
+	}
+
+	down_read(&log->ring_sem);
+	ring = log->ring;
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
-		ret = log->size;
+		ret = ring->size;
 		break;
 	case LOGGER_GET_LOG_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -486,10 +727,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		logger_peek(log, reader, &entry);
+		len = (size_t) atomic_long_read(&ring->w_pos) - reader->r_off;
+		mutex_unlock(&reader->mutex);
+		ret = min(len, ring->size);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -497,25 +739,110 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
+		mutex_lock(&reader->mutex);
+		if (logger_peek(log, reader, &entry))
+			ret = sizeof(struct logger_entry) + entry.len;
 		else
 			ret = 0;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers catch up with the new head in logger_peek() */
+		ring->head = atomic_long_read(&ring->w_pos);
 		ret = 0;
 		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
+		ret = 0;
+		break;
+	case LOGGER_SET_CLOCK:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != CLOCK_REALTIME && arg != CLOCK_MONOTONIC) {
+			ret = -EINVAL;
+			break;
+		}
+		log->clock = arg;
+		ret = 0;
+		break;
+	case LOGGER_GET_CLOCK:
+		ret = log->clock;
+		break;
+	case LOGGER_GET_WRITE_POS:
+		pos = atomic_long_read(&ring->w_pos);
+		break;
+	}
+
+	up_read(&log->ring_sem);
+
+	/* not under log->ring_sem, see struct logger_reader */
+	if (cmd == LOGGER_GET_WRITE_POS)
+		ret = put_user(pos, (__u32 __user *) arg);
+
+	return ret;
+}
+
+static void logger_vma_open(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_inc(&log->mapped);
+}
+
+static void logger_vma_close(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_dec(&log->mapped);
+}
+
+static struct vm_operations_struct logger_vm_ops = {
+	.open = logger_vma_open,
+	.close = logger_vma_close,
+};
+
+/*
+ * logger_mmap - maps the ring read-only, see logger.h for its layout
+ *
+ * The log cannot be resized while it is mapped.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	down_read(&log->ring_sem);
+	if (vma->vm_pgoff || size > PAGE_ALIGN(log->ring->size)) {
+		ret = -EINVAL;
+		goto out;
 	}
 
-	mutex_unlock(&log->mutex);
+	ret = remap_vmalloc_range(vma, log->ring->buffer, 0);
+	if (ret)
+		goto out;
 
+	vma->vm_ops = &logger_vm_ops;
+	vma->vm_private_data = log;
+	logger_vma_open(vma);
+
+out:
+	up_read(&log->ring_sem);
 	return ret;
 }
 
@@ -524,84 +851,161 @@ static struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
 	.release = logger_release,
 };
 
-/*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
- */
-#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
-static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
-	.misc = { \
-		.minor = MISC_DYNAMIC_MINOR, \
-		.name = NAME, \
-		.fops = &logger_fops, \
-		.parent = NULL, \
-	}, \
-	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
-	.size = SIZE, \
-};
+static struct logger_ring *logger_alloc_ring(size_t size, size_t start)
+{
+	struct logger_ring *ring;
+	size_t chunks = size >> LOGGER_CHUNK_SHIFT;
 
-DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024)
-DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024)
-DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 64*1024)
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+
+	ring->buffer = vmalloc_user(size);
+	if (!ring->buffer)
+		goto err_alloc_buffer_failed;
+
+	ring->chunk = vmalloc(chunks * sizeof(*ring->chunk));
+	if (!ring->chunk)
+		goto err_alloc_chunk_failed;
+	memset(ring->chunk, 0, chunks * sizeof(*ring->chunk));
+
+	ring->size = size;
+	atomic_long_set(&ring->w_pos, start);
+	ring->head = start;
+
+	/* the first entry goes at 'start', which is not committed yet */
+	ring->chunk[logger_chunk(start)] = start;
+	*(__u32 *) (ring->buffer + logger_offset(start)) = LOGGER_SEQ_BUSY;
+
+	return ring;
+
+err_alloc_chunk_failed:
+	vfree(ring->buffer);
+err_alloc_buffer_failed:
+	kfree(ring);
+	return NULL;
+}
+
+static void logger_free_ring(struct logger_ring *ring)
+{
+	vfree(ring->chunk);
+	vfree(ring->buffer);
+	kfree(ring);
+}
 
 static struct logger_log * get_log_from_minor(int minor)
 {
-	if (log_main.misc.minor == minor)
-		return &log_main;
-	if (log_events.misc.minor == minor)
-		return &log_events;
-	if (log_radio.misc.minor == minor)
-		return &log_radio;
-	return NULL;
+	struct logger_log *log;
+
+	mutex_lock(&logger_logs_lock);
+	list_for_each_entry(log, &logger_logs, list) {
+		if (log->misc.minor == minor)
+			goto out;
+	}
+	log = NULL;
+out:
+	mutex_unlock(&logger_logs_lock);
+	return log;
 }
 
-static int __init init_log(struct logger_log *log)
+/*
+ * logger_create_log - creates and registers the log 'name' of 'size' bytes,
+ * rounded up to a power of two.  Logs are never destroyed.
+ */
+static struct logger_log *logger_create_log(const char *name,
+					    unsigned long size)
 {
+	struct logger_log *log;
+	struct logger_log *tmp;
+	int count = 0;
 	int ret;
 
+	size = roundup_pow_of_two(clamp_t(unsigned long, size,
+					  LOGGER_MIN_SIZE, LOGGER_MAX_SIZE));
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return ERR_PTR(-ENOMEM);
+
+	log->ring = logger_alloc_ring(size, 0);
+	if (!log->ring) {
+		ret = -ENOMEM;
+		goto err_alloc_ring_failed;
+	}
+
+	strlcpy(log->name, name, sizeof(log->name));
+	init_rwsem(&log->ring_sem);
+	init_waitqueue_head(&log->wq);
+	log->clock = CLOCK_REALTIME;
+	log->misc.minor = MISC_DYNAMIC_MINOR;
+	log->misc.name = log->name;
+	log->misc.fops = &logger_fops;
+
+	mutex_lock(&logger_logs_lock);
+	list_for_each_entry(tmp, &logger_logs, list) {
+		if (!strcmp(tmp->name, log->name)) {
+			ret = -EEXIST;
+			goto err_name_taken;
+		}
+		count++;
+	}
+	if (count >= LOGGER_MAX_LOGS) {
+		ret = -ENOSPC;
+		goto err_name_taken;
+	}
+	list_add_tail(&log->list, &logger_logs);
+	mutex_unlock(&logger_logs_lock);
+
+	/*
+	 * Not under logger_logs_lock: misc_open() calls logger_open() with
+	 * misc_mtx held.  Until then the log has no minor anyone can open.
+	 */
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
-		return ret;
+		goto err_register_failed;
 	}
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
-
-	return 0;
+	       (unsigned long) log->ring->size >> 10, log->misc.name);
+
+	return log;
+
+err_register_failed:
+	mutex_lock(&logger_logs_lock);
+	list_del(&log->list);
+err_name_taken:
+	mutex_unlock(&logger_logs_lock);
+	logger_free_ring(log->ring);
+err_alloc_ring_failed:
+	kfree(log);
+	return ERR_PTR(ret);
 }
 
 static int __init logger_init(void)
 {
-	int ret;
+	struct logger_log *log;
 
-	ret = init_log(&log_main);
-	if (unlikely(ret))
-		goto out;
+	log = logger_create_log(LOGGER_LOG_MAIN, logger_main_size);
+	if (unlikely(IS_ERR(log)))
+		return PTR_ERR(log);
 
-	ret = init_log(&log_events);
-	if (unlikely(ret))
-		goto out;
+	log = logger_create_log(LOGGER_LOG_EVENTS, logger_events_size);
+	if (unlikely(IS_ERR(log)))
+		return PTR_ERR(log);
 
-	ret = init_log(&log_radio);
-	if (unlikely(ret))
-		goto out;
+	log = logger_create_log(LOGGER_LOG_RADIO, logger_radio_size);
+	if (unlikely(IS_ERR(log)))
+		return PTR_ERR(log);
 
-out:
-	return ret;
+	return 0;
 }
 device_initcall(logger_init);
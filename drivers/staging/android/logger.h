@@ -38,11 +38,42 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+/*
+ * Layout of the ring as mapped by mmap().  Every entry starts on a 4 byte
+ * boundary with a 32-bit sequence word, followed by its struct logger_entry
+ * and payload, and the next one starts LOGGER_REC_LEN(len) bytes on.  Ring
+ * positions grow without bound and index the ring modulo its size; an entry
+ * may wrap around the end of the ring, its sequence word never does.  The
+ * entry at position 'pos' is complete if its sequence word equals the low 32
+ * bits of 'pos', and still intact as long as LOGGER_GET_WRITE_POS stays
+ * within a ring size of 'pos'.
+ */
+#define LOGGER_SEQ_BUSY		((__u32) ~0)	/* entry being written */
+#define LOGGER_REC_LEN(len)	\
+	((sizeof(__u32) + sizeof(struct logger_entry) + (len) + 3) & ~3)
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* whole entries */
+#define LOGGER_SET_CLOCK		_IO(__LOGGERIO, 6) /* stamp clock */
+#define LOGGER_GET_CLOCK		_IO(__LOGGERIO, 7)
+#define LOGGER_GET_WRITE_POS		_IOR(__LOGGERIO, 8, __u32)
+#define LOGGER_SET_LOG_BUF_SIZE		_IO(__LOGGERIO, 9) /* resize, flushes */
+#define LOGGER_NEW_LOG			_IOW(__LOGGERIO, 10, struct logger_new_log)
+
+#define LOGGER_NAME_LEN			24
+
+/*
+ * Argument of LOGGER_NEW_LOG: creates the log "log_<name>" of 'size' bytes,
+ * rounded up to a power of two.  'name' is made of letters, digits and '_'.
+ */
+struct logger_new_log {
+	char		name[LOGGER_NAME_LEN];
+	__u32		size;
+};
 
 #endif /* _LINUX_LOGGER_H */
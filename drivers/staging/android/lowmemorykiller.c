@@ -18,6 +18,12 @@
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
 
 static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask);
 
@@ -40,6 +46,8 @@ static size_t lowmem_minfree[6] = {
 	16*1024, // 64MB
 };
 static int lowmem_minfree_size = 4;
+/* /dev/mem_notify levels start this many percent above lowmem_minfree[] */
+static int lowmem_notify_margin = 25;
 
 #define lowmem_print(level, x...) do { if(lowmem_debug_level >= (level)) printk(x); } while(0)
 
@@ -47,6 +55,190 @@ module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size, S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size, S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_margin, lowmem_notify_margin, int, S_IRUGO | S_IWUSR);
+
+/*
+ * Processes are kept on one list per oomkilladj, so that finding a victim
+ * only looks at the highest adj that has any.  The lists are kept up to
+ * date by the oom_adj notifier and protected by lowmem_lock, which also
+ * keeps the mm of listed tasks from going away: tasks leave their list
+ * before exit_mm().
+ */
+#define LOWMEM_BUCKETS (OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define lowmem_bucket(adj) (&lowmem_buckets[(adj) - OOM_DISABLE])
+
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_lock);
+
+/*
+ * The last victim, until it has exited or a second has passed.  No new
+ * victim is picked meanwhile, as the memory is on its way back.
+ */
+static struct task_struct *lowmem_deathpending;
+static unsigned long lowmem_deathpending_timeout;
+
+/* caller holds lowmem_lock */
+static void lowmem_track(struct task_struct *p)
+{
+	int adj = p->oomkilladj;
+
+	if (adj < OOM_DISABLE)
+		adj = OOM_DISABLE;
+	else if (adj > OOM_ADJUST_MAX)
+		adj = OOM_ADJUST_MAX;
+	list_move_tail(&p->lowmem_entry, lowmem_bucket(adj));
+}
+
+static int lowmem_oom_adj_notify(struct notifier_block *self,
+				 unsigned long event, void *data)
+{
+	struct task_struct *p = data;
+
+	spin_lock(&lowmem_lock);
+	switch (event) {
+	case OOM_ADJ_FORKED:
+	case OOM_ADJ_LEADER:
+		lowmem_track(p);
+		break;
+	case OOM_ADJ_CHANGED:
+		/* exiting tasks have left, and must not come back */
+		if (!list_empty(&p->lowmem_entry))
+			lowmem_track(p);
+		break;
+	case OOM_ADJ_EXITING:
+		list_del_init(&p->lowmem_entry);
+		if (p == lowmem_deathpending)
+			lowmem_deathpending = NULL;
+		break;
+	}
+	spin_unlock(&lowmem_lock);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_oom_adj_nb = {
+	.notifier_call = lowmem_oom_adj_notify,
+};
+
+static int lowmem_array_size(void)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if(lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if(lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	return array_size;
+}
+
+/*
+ * Memory pressure as reported by /dev/mem_notify: 0 if there is none,
+ * otherwise the number of lowmem_minfree[] thresholds, raised by
+ * lowmem_notify_margin percent, that free memory is below.  Level n
+ * therefore warns that processes of oom_adj lowmem_adj[size - n] and
+ * up are about to be killed.
+ */
+static int lowmem_pressure_level(int other_free, int other_file)
+{
+	int i;
+	int array_size = lowmem_array_size();
+
+	for(i = 0; i < array_size; i++) {
+		int minfree = lowmem_minfree[i] +
+			lowmem_minfree[i] * lowmem_notify_margin / 100;
+
+		if (other_free < minfree && other_file < minfree)
+			return array_size - i;
+	}
+	return 0;
+}
+
+static int lowmem_current_level(void)
+{
+	return lowmem_pressure_level(global_page_state(NR_FREE_PAGES),
+				     global_page_state(NR_FILE_PAGES));
+}
+
+/*
+ * The level last seen by lowmem_shrink() or a reader; lowmem_shrink() wakes
+ * up lowmem_notify_wait when it finds another non-zero level.  Readers
+ * update it too, as the shrinker does not run once the pressure eases.
+ */
+static int lowmem_notify_level;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+
+/*
+ * Each open file remembers the level it last read in private_data and is
+ * readable while the pressure is at another non-zero level.  The shrinker
+ * rarely runs without pressure, so a level below the one read last is
+ * reported as well: the pressure may have eased and risen again unseen.
+ * When it is gone, 0 becomes the new base without waking the reader.
+ */
+static int lowmem_notify_pending(struct file *file)
+{
+	long seen = (long)file->private_data;
+	int level = lowmem_current_level();
+
+	lowmem_notify_level = level;
+	if (!level)
+		file->private_data = (void *)0L;
+	return level && level != seen;
+}
+
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)0L;
+	return nonseekable_open(inode, file);
+}
+
+/*
+ * read() returns the current level as text, blocking unless O_NONBLOCK
+ * until it is non-zero and differs from the one read last.
+ */
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	char tmp[16];
+	int level;
+	int len;
+	int ret;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(lowmem_notify_wait,
+					       lowmem_notify_pending(file));
+		if (ret)
+			return ret;
+	}
+
+	level = lowmem_current_level();
+	len = snprintf(tmp, sizeof(tmp), "%d\n", level);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, tmp, len))
+		return -EFAULT;
+	file->private_data = (void *)(long)level;
+	return len;
+}
+
+static unsigned int lowmem_notify_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (lowmem_notify_pending(file))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_notify_open,
+	.read = lowmem_notify_read,
+	.poll = lowmem_notify_poll,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mem_notify",
+	.fops = &lowmem_notify_fops,
+};
 
 static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
@@ -55,15 +247,19 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 	int rem = 0;
 	int tasksize;
 	int i;
+	int adj;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int array_size = lowmem_array_size();
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES);
-	if(lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if(lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
+	int level = lowmem_pressure_level(other_free, other_file);
+
+	if (level != lowmem_notify_level) {
+		lowmem_notify_level = level;
+		if (level)
+			wake_up_interruptible(&lowmem_notify_wait);
+	}
 	for(i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
@@ -82,46 +278,86 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 		return rem;
 	}
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		if (p->oomkilladj < min_adj || !p->mm)
-			continue;
-		tasksize = get_mm_rss(p->mm);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (p->oomkilladj < selected->oomkilladj)
+	spin_lock(&lowmem_lock);
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		spin_unlock(&lowmem_lock);
+		lowmem_print(4, "lowmem_shrink %d, %x, kill pending, return %d\n", nr_to_scan, gfp_mask, rem);
+		return rem;
+	}
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		list_for_each_entry(p, lowmem_bucket(adj), lowmem_entry) {
+			task_lock(p);
+			tasksize = p->mm ? get_mm_rss(p->mm) : 0;
+			task_unlock(p);
+			if (tasksize <= 0)
 				continue;
-			if (p->oomkilladj == selected->oomkilladj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			             p->pid, p->comm, p->oomkilladj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-		             p->pid, p->comm, p->oomkilladj, tasksize);
 	}
 	if(selected != NULL) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 		             selected->pid, selected->comm,
 		             selected->oomkilladj, selected_tasksize);
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n", nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
+	spin_unlock(&lowmem_lock);
 	return rem;
 }
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	/*
+	 * Pick up the processes that are already there.  Forks racing with
+	 * this are reported to us too, which does no harm; exiting ones have
+	 * PF_EXITING set before they are reported.
+	 */
+	register_oom_adj_notifier(&lowmem_oom_adj_nb);
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_lock);
+	for_each_process(p) {
+		if (!(p->flags & PF_EXITING))
+			lowmem_track(p);
+	}
+	spin_unlock(&lowmem_lock);
+	read_unlock(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_notify_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register mem_notify\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct task_struct *p, *tmp;
+	int i;
+
+	misc_deregister(&lowmem_notify_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_oom_adj_notifier(&lowmem_oom_adj_nb);
+	spin_lock(&lowmem_lock);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		list_for_each_entry_safe(p, tmp, &lowmem_buckets[i], lowmem_entry)
+			list_del_init(&p->lowmem_entry);
+	spin_unlock(&lowmem_lock);
 }
 
 module_init(lowmem_init);
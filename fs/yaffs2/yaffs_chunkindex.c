@@ -0,0 +1,135 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Chunk index.
+ *
+ * On large devices a level 0 tnode only holds the chunk group a data
+ * chunk lives in, and finding the chunk itself means reading the tags
+ * of every chunk in the group until one matches. The chunk index
+ * remembers the exact NAND chunk of recently placed or found data
+ * chunks so that lookups don't go to NAND at all.
+ *
+ * The index is a direct mapped table, keyed by the index serial of the
+ * object (unique to each incarnation of an object, so a reused object
+ * id never matches) and the chunk in the file. Its size is capped by
+ * dev->chunkIndexBytes. An entry is only a hint: the caller checks it
+ * against the chunk group still recorded in the tnode.
+ */
+
+const char *yaffs_chunkindex_c_version =
+	"$Id$";
+
+#include "yaffs_chunkindex.h"
+
+static __u32 yaffs_ChunkIndexSlot(yaffs_Device *dev, const yaffs_Object *obj,
+				int chunkInInode)
+{
+	/* Consecutive chunks of a file land in consecutive slots */
+	return (obj->indexSerial * 2654435761U + chunkInInode) &
+		dev->chunkIndexMask;
+}
+
+int yaffs_ChunkIndexInit(yaffs_Device *dev)
+{
+	__u32 nChunks;
+	__u32 nEntries;
+
+	dev->chunkIndex = NULL;
+	dev->chunkIndexMask = 0;
+	dev->nChunkIndexEntries = 0;
+
+	/* Tnodes are exact, nothing to look up */
+	if (dev->chunkGroupBits == 0)
+		return YAFFS_OK;
+
+	nChunks = (dev->endBlock - dev->startBlock + 1) * dev->nChunksPerBlock;
+
+	/* Largest power of 2 that fits the cap, no more than one per chunk */
+	nEntries = 1;
+	while (nEntries * 2 * sizeof(yaffs_ChunkIndexEntry) <=
+	       dev->chunkIndexBytes && nEntries * 2 <= nChunks)
+		nEntries *= 2;
+
+	if (nEntries * sizeof(yaffs_ChunkIndexEntry) > dev->chunkIndexBytes)
+		return YAFFS_OK;
+
+	dev->chunkIndex = YMALLOC(nEntries * sizeof(yaffs_ChunkIndexEntry));
+	if (!dev->chunkIndex) {
+		/* Only a speed up, carry on without it */
+		T(YAFFS_TRACE_ALWAYS,
+		  (TSTR("yaffs: no memory for chunk index" TENDSTR)));
+		return YAFFS_OK;
+	}
+
+	memset(dev->chunkIndex, 0, nEntries * sizeof(yaffs_ChunkIndexEntry));
+	dev->chunkIndexMask = nEntries - 1;
+	dev->nChunkIndexEntries = nEntries;
+
+	return YAFFS_OK;
+}
+
+void yaffs_ChunkIndexDeinit(yaffs_Device *dev)
+{
+	if (dev->chunkIndex)
+		YFREE(dev->chunkIndex);
+	dev->chunkIndex = NULL;
+	dev->nChunkIndexEntries = 0;
+}
+
+/*
+ * Returns the indexed NAND chunk of chunkInInode if it lies in the chunk
+ * group starting at groupBase, else -1.
+ */
+int yaffs_ChunkIndexFind(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode, int groupBase)
+{
+	yaffs_ChunkIndexEntry *e;
+
+	if (!dev->chunkIndex || groupBase <= 0)
+		return -1;
+
+	e = &dev->chunkIndex[yaffs_ChunkIndexSlot(dev, obj, chunkInInode)];
+
+	if (e->serial != obj->indexSerial ||
+	    e->chunkInInode != chunkInInode ||
+	    e->chunkInNAND < groupBase ||
+	    e->chunkInNAND >= groupBase + dev->chunkGroupSize)
+		return -1;
+
+	return e->chunkInNAND;
+}
+
+void yaffs_ChunkIndexSet(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode, int chunkInNAND)
+{
+	yaffs_ChunkIndexEntry *e;
+
+	if (!dev->chunkIndex)
+		return;
+
+	e = &dev->chunkIndex[yaffs_ChunkIndexSlot(dev, obj, chunkInInode)];
+
+	e->serial = obj->indexSerial;
+	e->chunkInInode = chunkInInode;
+	e->chunkInNAND = chunkInNAND;
+}
+
+void yaffs_ChunkIndexForget(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode)
+{
+	yaffs_ChunkIndexEntry *e;
+
+	if (!dev->chunkIndex)
+		return;
+
+	e = &dev->chunkIndex[yaffs_ChunkIndexSlot(dev, obj, chunkInInode)];
+
+	if (e->serial == obj->indexSerial && e->chunkInInode == chunkInInode)
+		e->serial = 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+#ifndef __YAFFS_CHUNKINDEX_H__
+#define __YAFFS_CHUNKINDEX_H__
+
+#include "yaffs_guts.h"
+
+int yaffs_ChunkIndexInit(yaffs_Device *dev);
+void yaffs_ChunkIndexDeinit(yaffs_Device *dev);
+
+int yaffs_ChunkIndexFind(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode, int groupBase);
+void yaffs_ChunkIndexSet(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode, int chunkInNAND);
+void yaffs_ChunkIndexForget(yaffs_Device *dev, const yaffs_Object *obj,
+			int chunkInInode);
+
+#endif
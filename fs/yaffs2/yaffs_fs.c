@@ -1783,6 +1783,8 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int no_summary;
+	int no_chunk_index;
 } yaffs_options;
 
 #define MAX_OPT_LEN 20
@@ -1817,7 +1819,11 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 		else if (!strcmp(cur_opt, "no-checkpoint")) {
 			options->skip_checkpoint_read = 1;
 			options->skip_checkpoint_write = 1;
-		} else {
+		} else if (!strcmp(cur_opt, "no-summary"))
+			options->no_summary = 1;
+		else if (!strcmp(cur_opt, "no-chunk-index"))
+			options->no_chunk_index = 1;
+		else {
 			printk(KERN_INFO "yaffs: Bad mount option \"%s\"\n",
 					cur_opt);
 			error = 1;
@@ -2021,7 +2027,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	dev->nShortOpCaches = (options.no_cache) ? 0 : 32;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2080,6 +2086,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	dev->skipCheckpointRead = options.skip_checkpoint_read;
 	dev->skipCheckpointWrite = options.skip_checkpoint_write;
+	dev->summaryDisabled = options.no_summary;
+	dev->chunkIndexBytes = (options.no_chunk_index) ? 0 : 64 * 1024;
 
 	/* we assume this is protected by lock_kernel() in mount/umount */
 	ylist_add_tail(&dev->devList, &yaffs_dev_list);
@@ -2262,6 +2270,13 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "useNANDECC......... %d\n", dev->useNANDECC);
 	buf += sprintf(buf, "isYaffs2........... %d\n", dev->isYaffs2);
 	buf += sprintf(buf, "inbandTags......... %d\n", dev->inbandTags);
+	buf += sprintf(buf, "nSummaryChunks..... %d\n", dev->nSummaryChunks);
+	buf += sprintf(buf, "nSummaryWrites..... %d\n", dev->nSummaryWrites);
+	buf += sprintf(buf, "nSummaryScans...... %d\n", dev->nSummaryScans);
+	buf += sprintf(buf, "nChunkIndexEntries. %d\n", dev->nChunkIndexEntries);
+	buf += sprintf(buf, "nChunkLookups...... %d\n", dev->nChunkLookups);
+	buf += sprintf(buf, "nChunkIndexHits.... %d\n", dev->nChunkIndexHits);
+	buf += sprintf(buf, "nGroupTagReads..... %d\n", dev->nGroupTagReads);
 
 	return buf;
 }
@@ -28,6 +28,8 @@ const char *yaffs_guts_c_version =
 #include "yaffs_nand.h"
 
 #include "yaffs_checkptrw.h"
+#include "yaffs_summary.h"
+#include "yaffs_chunkindex.h"
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
@@ -91,6 +93,8 @@ static void yaffs_VerifyFreeChunks(yaffs_Device *dev);
 
 static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in);
 
+static __u16 yaffs_CalcNameSum(const YCHAR *name);
+
 static void yaffs_VerifyDirectory(yaffs_Object *directory);
 #ifdef YAFFS_PARANOID
 static int yaffs_CheckFileSanity(yaffs_Object *in);
@@ -373,6 +377,37 @@ static Y_INLINE int yaffs_StillSomeChunkBits(yaffs_Device *dev, int blk)
 	return 0;
 }
 
+/* Summary chunks can't be allocated, so a block that has a summary counts
+ * them as in use until it gets erased.
+ */
+static void yaffs_ClaimSummaryChunks(yaffs_Device *dev, yaffs_BlockInfo *bi,
+					int blk)
+{
+	int i;
+
+	for (i = dev->nChunksPerBlock - dev->nSummaryChunks;
+	     i < dev->nChunksPerBlock; i++)
+		yaffs_SetChunkBit(dev, blk, i);
+
+	bi->pagesInUse += dev->nSummaryChunks;
+	bi->hasSummary = 1;
+}
+
+static Y_INLINE int yaffs_IsSummaryChunk(yaffs_Device *dev,
+					yaffs_BlockInfo *bi, int chunkInBlock)
+{
+	return bi->hasSummary &&
+		chunkInBlock >= dev->nChunksPerBlock - dev->nSummaryChunks;
+}
+
+/* Pages in use that are not claimed by the summary */
+static Y_INLINE int yaffs_BlockDataPages(yaffs_Device *dev,
+					yaffs_BlockInfo *bi)
+{
+	return bi->hasSummary ?
+		bi->pagesInUse - dev->nSummaryChunks : bi->pagesInUse;
+}
+
 static int yaffs_CountChunkBits(yaffs_Device *dev, int blk)
 {
 	__u8 *blkBits = yaffs_BlockBits(dev, blk);
@@ -994,6 +1029,9 @@ static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_HandleWriteChunkOk(dev, chunk, data, tags);
 
+		yaffs_SummaryAdd(dev, tags, chunk, tags->chunkId ? 0 :
+			yaffs_CalcNameSum(((yaffs_ObjectHeader *)data)->name));
+
 	} while (writeOk != YAFFS_OK &&
 		(yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1544,6 +1582,7 @@ static int yaffs_FindChunkInGroup(yaffs_Device *dev, int theChunk,
 	for (j = 0; theChunk && j < dev->chunkGroupSize; j++) {
 		if (yaffs_CheckChunkBit(dev, theChunk / dev->nChunksPerBlock,
 				theChunk % dev->nChunksPerBlock)) {
+			dev->nGroupTagReads++;
 			yaffs_ReadChunkWithTagsFromNAND(dev, theChunk, NULL,
 							tags);
 			if (yaffs_TagsMatch(tags, objectId, chunkInInode)) {
@@ -1910,6 +1949,11 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device *dev)
 		memset(tn, 0, sizeof(yaffs_Object));
 		tn->beingCreated = 1;
 
+		/* 0 is never a valid serial */
+		if (++dev->chunkIndexSerial == 0)
+			dev->chunkIndexSerial++;
+		tn->indexSerial = dev->chunkIndexSerial;
+
 		tn->myDev = dev;
 		tn->hdrChunk = 0;
 		tn->variantType = YAFFS_OBJECT_TYPE_UNKNOWN;
@@ -2719,6 +2763,13 @@ static void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 
 	bi->blockState = YAFFS_BLOCK_STATE_DIRTY;
 
+	if (bi->hasSummary) {
+		/* The summary goes with the erase */
+		bi->pagesInUse -= dev->nSummaryChunks;
+		bi->hasSummary = 0;
+		dev->nFreeChunks += dev->nSummaryChunks;
+	}
+
 	if (!bi->needsRetiring) {
 		yaffs_InvalidateCheckpoint(dev);
 		erasedOk = yaffs_EraseBlockInNAND(dev, blockNo);
@@ -2873,16 +2924,38 @@ static int yaffs_CheckSpaceForAllocation(yaffs_Device *dev)
 	return (dev->nFreeChunks > reservedChunks);
 }
 
+/* The allocation block is full. What is left over is for the summary. */
+static void yaffs_CloseAllocationBlock(yaffs_Device *dev, yaffs_BlockInfo *bi)
+{
+	if (dev->chunksPerSummary < dev->nChunksPerBlock &&
+	    dev->allocationPage == dev->chunksPerSummary) {
+		yaffs_ClaimSummaryChunks(dev, bi, dev->allocationBlock);
+		dev->nFreeChunks -= dev->nSummaryChunks;
+	}
+
+	bi->blockState = YAFFS_BLOCK_STATE_FULL;
+	dev->allocationBlock = -1;
+}
+
 static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		yaffs_BlockInfo **blockUsedPtr)
 {
 	int retVal;
 	yaffs_BlockInfo *bi;
 
+	if (dev->allocationBlock >= 0 &&
+	    dev->allocationPage >= dev->chunksPerSummary) {
+		/* Picked up from the scan, the rest is for the summary */
+		bi = yaffs_GetBlockInfo(dev, dev->allocationBlock);
+		yaffs_CloseAllocationBlock(dev, bi);
+	}
+
 	if (dev->allocationBlock < 0) {
 		/* Get next block to allocate off */
 		dev->allocationBlock = yaffs_FindBlockForAllocation(dev);
 		dev->allocationPage = 0;
+		if (dev->allocationBlock >= 0)
+			yaffs_SummaryStart(dev, dev->allocationBlock);
 	}
 
 	if (!useReserve && !yaffs_CheckSpaceForAllocation(dev)) {
@@ -2910,10 +2983,8 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		dev->nFreeChunks--;
 
 		/* If the block is full set the state to full */
-		if (dev->allocationPage >= dev->nChunksPerBlock) {
-			bi->blockState = YAFFS_BLOCK_STATE_FULL;
-			dev->allocationBlock = -1;
-		}
+		if (dev->allocationPage >= dev->chunksPerSummary)
+			yaffs_CloseAllocationBlock(dev, bi);
 
 		if (blockUsedPtr)
 			*blockUsedPtr = bi;
@@ -2931,10 +3002,10 @@ static int yaffs_GetErasedChunks(yaffs_Device *dev)
 {
 	int n;
 
-	n = dev->nErasedBlocks * dev->nChunksPerBlock;
+	n = dev->nErasedBlocks * dev->chunksPerSummary;
 
 	if (dev->allocationBlock > 0)
-		n += (dev->nChunksPerBlock - dev->allocationPage);
+		n += (dev->chunksPerSummary - dev->allocationPage);
 
 	return n;
 
@@ -2985,7 +3056,8 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	dev->isDoingGC = 1;
 
 	if (isCheckpointBlock ||
-			!yaffs_StillSomeChunkBits(dev, block)) {
+			!yaffs_StillSomeChunkBits(dev, block) ||
+			yaffs_BlockDataPages(dev, bi) == 0) {
 		T(YAFFS_TRACE_TRACING,
 				(TSTR
 				 ("Collecting block %d that has no chunks in use" TENDSTR),
@@ -3006,7 +3078,8 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 		     (bi->blockState == YAFFS_BLOCK_STATE_COLLECTING) &&
 		     maxCopies > 0;
 		     dev->gcChunk++, oldChunk++) {
-			if (yaffs_CheckChunkBit(dev, block, dev->gcChunk)) {
+			if (yaffs_CheckChunkBit(dev, block, dev->gcChunk) &&
+			    !yaffs_IsSummaryChunk(dev, bi, dev->gcChunk)) {
 
 				/* This page is in use and might need to be copied off */
 
@@ -3272,6 +3345,32 @@ static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
 
 /*-------------------- Data file manipulation -----------------*/
 
+/* Look in the chunk index before searching the group.
+ * The index has no tags, so only used if the caller doesn't want them.
+ */
+static int yaffs_FindIndexedChunk(yaffs_Object *in, int theChunk,
+				int chunkInInode, int wantTags)
+{
+	yaffs_Device *dev = in->myDev;
+	int chunk;
+
+	dev->nChunkLookups++;
+
+	if (wantTags)
+		return -1;
+
+	chunk = yaffs_ChunkIndexFind(dev, in, chunkInInode, theChunk);
+
+	if (chunk >= 0 &&
+	    yaffs_CheckChunkBit(dev, chunk / dev->nChunksPerBlock,
+				chunk % dev->nChunksPerBlock)) {
+		dev->nChunkIndexHits++;
+		return chunk;
+	}
+
+	return -1;
+}
+
 static int yaffs_FindChunkInFile(yaffs_Object *in, int chunkInInode,
 				 yaffs_ExtendedTags *tags)
 {
@@ -3280,6 +3379,7 @@ static int yaffs_FindChunkInFile(yaffs_Object *in, int chunkInInode,
 	int theChunk = -1;
 	yaffs_ExtendedTags localTags;
 	int retVal = -1;
+	int wantTags = (tags != NULL);
 
 	yaffs_Device *dev = in->myDev;
 
@@ -3293,9 +3393,17 @@ static int yaffs_FindChunkInFile(yaffs_Object *in, int chunkInInode,
 	if (tn) {
 		theChunk = yaffs_GetChunkGroupBase(dev, tn, chunkInInode);
 
+		retVal = yaffs_FindIndexedChunk(in, theChunk, chunkInInode,
+						wantTags);
+		if (retVal >= 0)
+			return retVal;
+
 		retVal =
 		    yaffs_FindChunkInGroup(dev, theChunk, tags, in->objectId,
 					   chunkInInode);
+
+		if (retVal >= 0)
+			yaffs_ChunkIndexSet(dev, in, chunkInInode, retVal);
 	}
 	return retVal;
 }
@@ -3322,13 +3430,18 @@ static int yaffs_FindAndDeleteChunkInFile(yaffs_Object *in, int chunkInInode,
 
 		theChunk = yaffs_GetChunkGroupBase(dev, tn, chunkInInode);
 
-		retVal =
-		    yaffs_FindChunkInGroup(dev, theChunk, tags, in->objectId,
-					   chunkInInode);
+		retVal = yaffs_FindIndexedChunk(in, theChunk, chunkInInode,
+						tags != &localTags);
+		if (retVal < 0)
+			retVal =
+			    yaffs_FindChunkInGroup(dev, theChunk, tags,
+						   in->objectId, chunkInInode);
 
 		/* Delete the entry in the filestructure (if found) */
-		if (retVal != -1)
+		if (retVal != -1) {
 			yaffs_PutLevel0Tnode(dev, tn, chunkInInode, 0);
+			yaffs_ChunkIndexForget(dev, in, chunkInInode);
+		}
 	}
 
 	return retVal;
@@ -3511,6 +3624,7 @@ static int yaffs_PutChunkIntoFile(yaffs_Object *in, int chunkInInode,
 		in->nDataChunks++;
 
 	yaffs_PutLevel0Tnode(dev, tn, chunkInInode, chunkInNAND);
+	yaffs_ChunkIndexSet(dev, in, chunkInInode, chunkInNAND);
 
 	return YAFFS_OK;
 }
@@ -3585,7 +3699,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 
 		bi->pagesInUse--;
 
-		if (bi->pagesInUse == 0 &&
+		if (yaffs_BlockDataPages(dev, bi) == 0 &&
 		    !bi->hasShrinkHeader &&
 		    bi->blockState != YAFFS_BLOCK_STATE_ALLOCATING &&
 		    bi->blockState != YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
@@ -3826,10 +3940,51 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   There are a limited number of cache chunks per device. Lookups by object
+ *   and chunk go through a small hash, everything else just walks the array.
  */
 
+static int yaffs_ChunkCacheBucket(const yaffs_Object *obj, int chunkId)
+{
+	return (obj->objectId + chunkId) & (YAFFS_SHORT_OP_HASH_BUCKETS - 1);
+}
+
+/* Free up a cache chunk. Doesn't touch the data or the dirty flag. */
+static void yaffs_ReleaseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	yaffs_ChunkCache **p;
+
+	if (!cache->object)
+		return;
+
+	p = &dev->srHash[cache->hashBucket];
+	while (*p && *p != cache)
+		p = &(*p)->hashNext;
+	if (*p)
+		*p = cache->hashNext;
+
+	cache->hashNext = NULL;
+	cache->object = NULL;
+}
+
+/* Give a cache chunk to a chunk of an object.
+ * A clean chunk pushed out by yaffs_GrabChunkCache() is still hashed
+ * under its old owner, so unhash it first.
+ */
+static void yaffs_AssignChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
+				yaffs_Object *obj, int chunkId)
+{
+	int bucket = yaffs_ChunkCacheBucket(obj, chunkId);
+
+	yaffs_ReleaseChunkCache(dev, cache);
+
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->hashBucket = bucket;
+	cache->hashNext = dev->srHash[bucket];
+	dev->srHash[bucket] = cache;
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -3884,7 +4039,7 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 								 cache->nBytes,
 								 1);
 				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_ReleaseChunkCache(dev, cache);
 			}
 
 		} while (cache && chunkWritten > 0);
@@ -4004,14 +4159,16 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	yaffs_ChunkCache *cache;
+
 	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
+		cache = dev->srHash[yaffs_ChunkCacheBucket(obj, chunkId)];
+		for (; cache; cache = cache->hashNext) {
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId) {
 				dev->cacheHits++;
 
-				return &dev->srCache[i];
+				return cache;
 			}
 		}
 	}
@@ -4052,7 +4209,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(object->myDev, cache);
 	}
 }
 
@@ -4068,7 +4225,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_ReleaseChunkCache(dev, &dev->srCache[i]);
 		}
 	}
 }
@@ -4213,6 +4370,7 @@ static void yaffs_ObjectToCheckpointObject(yaffs_CheckpointObject *cp,
 	cp->renameAllowed = obj->renameAllowed;
 	cp->unlinkAllowed = obj->unlinkAllowed;
 	cp->serial = obj->serial;
+	cp->sum = obj->sum;
 	cp->nDataChunks = obj->nDataChunks;
 
 	if (obj->variantType == YAFFS_OBJECT_TYPE_FILE)
@@ -4265,6 +4423,7 @@ static int yaffs_CheckpointObjectToObject(yaffs_Object *obj, yaffs_CheckpointObj
 	obj->renameAllowed = cp->renameAllowed;
 	obj->unlinkAllowed = cp->unlinkAllowed;
 	obj->serial = cp->serial;
+	obj->sum = cp->sum;
 	obj->nDataChunks = cp->nDataChunks;
 
 	if (obj->variantType == YAFFS_OBJECT_TYPE_FILE)
@@ -4691,8 +4850,7 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 				if (!cache) {
 					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					yaffs_AssignChunkCache(dev, cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -4821,8 +4979,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
 					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					yaffs_AssignChunkCache(dev, cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -5952,6 +6109,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	int foundChunksInBlock;
 	int equivalentObjectId;
 	int alloc_failed = 0;
+	int summaryAvailable;
+	int summaryTail;
+	__u16 nameSum;
 
 
 	yaffs_BlockIndex *blockIndex = NULL;
@@ -5994,6 +6154,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 		yaffs_ClearChunkBits(dev, blk);
 		bi->pagesInUse = 0;
 		bi->softDeletions = 0;
+		bi->hasSummary = 0;
 
 		yaffs_QueryInitialBlockState(dev, blk, &state, &sequenceNumber);
 
@@ -6103,9 +6264,25 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		/* A full block with a summary doesn't need its tags read
+		 * one by one. Any unused entry is a chunk that got skipped.
+		 * The summary chunks (or the unused chunks that were left
+		 * for a summary that didn't get written) get claimed once
+		 * the block is known to be full.
+		 */
+		summaryAvailable =
+			(yaffs_SummaryRead(dev, blk) == YAFFS_OK);
+		summaryTail = 0;
+		if (summaryAvailable) {
+			dev->nSummaryScans++;
+			dev->nFreeChunks += dev->nSummaryChunks;
+			summaryTail = dev->nSummaryChunks;
+		}
+
 		/* For each chunk in each block that needs scanning.... */
-		foundChunksInBlock = 0;
-		for (c = dev->nChunksPerBlock - 1;
+		foundChunksInBlock = summaryAvailable;
+		for (c = dev->nChunksPerBlock - 1 -
+			 (summaryAvailable ? dev->nSummaryChunks : 0);
 		     !alloc_failed && c >= 0 &&
 		     (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
 		      state == YAFFS_BLOCK_STATE_ALLOCATING); c--) {
@@ -6115,8 +6292,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			nameSum = 0;
+			if (summaryAvailable)
+				yaffs_SummaryFetch(dev, c, &tags, &nameSum);
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6151,10 +6332,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 							dev->allocationBlock = blk;
 							dev->allocationPage = c;
 							dev->allocationBlockFinder = blk;
-						} else {
+						} else if (c < dev->chunksPerSummary) {
 							/* This is a partially written block that is not
 							 * the current allocation block. This block must have
 							 * had a write failure, so set up for retirement.
+							 * (Above that it's a full block which lost its summary.)
 							 */
 
 							 /* bi->needsRetiring = 1; ??? TODO */
@@ -6167,6 +6349,10 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 					}
 				}
 
+				if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+				    c >= dev->nChunksPerBlock - dev->nSummaryChunks)
+					summaryTail++;
+
 				dev->nFreeChunks++;
 
 			} else if (tags.eccResult == YAFFS_ECC_RESULT_UNFIXED) {
@@ -6176,6 +6362,13 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 				  dev->nFreeChunks++;
 
+			} else if (tags.objectId == YAFFS_OBJECTID_SUMMARY) {
+				/* Summary of a block we scan the slow way anyway */
+				foundChunksInBlock = 1;
+				if (c >= dev->nChunksPerBlock - dev->nSummaryChunks)
+					summaryTail++;
+				dev->nFreeChunks++;
+
 			} else if (tags.chunkId > 0) {
 				/* chunkId > 0 so it is a data chunk... */
 				unsigned int endpos;
@@ -6445,6 +6638,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 						 isShrink = tags.extraIsShrinkHeader;
 						 equivalentObjectId = tags.extraEquivalentObjectId;
 						in->lazyLoaded = 1;
+						/* Known if it came from a summary */
+						in->sum = nameSum;
 
 					}
 					in->dirty = 0;
@@ -6552,12 +6747,18 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
 			/* If we got this far while scanning, then the block is fully allocated. */
 			state = YAFFS_BLOCK_STATE_FULL;
+
+			if (dev->nSummaryChunks > 0 &&
+			    summaryTail == dev->nSummaryChunks) {
+				yaffs_ClaimSummaryChunks(dev, bi, blk);
+				dev->nFreeChunks -= dev->nSummaryChunks;
+			}
 		}
 
 		bi->blockState = state;
 
 		/* Now let's see if it was dirty */
-		if (bi->pagesInUse == 0 &&
+		if (yaffs_BlockDataPages(dev, bi) == 0 &&
 		    !bi->hasShrinkHeader &&
 		    bi->blockState == YAFFS_BLOCK_STATE_FULL) {
 			yaffs_BlockBecameDirty(dev, blk);
@@ -6770,6 +6971,14 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 			if (l->parent != directory)
 				YBUG();
 
+			/* Don't load the header of a lazy loaded object whose
+			 * name sum is known, unless it could be the one.
+			 */
+			if (l->lazyLoaded && l->sum &&
+			    l->objectId != YAFFS_OBJECTID_LOSTNFOUND &&
+			    !yaffs_SumCompare(l->sum, sum))
+				continue;
+
 			yaffs_CheckObjectDetailsLoaded(l);
 
 			/* Special case for lost-n-found */
@@ -7277,6 +7486,7 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	memset(dev->srHash, 0, sizeof(dev->srHash));
 	dev->gcCleanupList = NULL;
 
 
@@ -7284,11 +7494,13 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
 		dev->srCache =  YMALLOC(srCacheBytes);
 
 		buf = (__u8 *) dev->srCache;
@@ -7316,6 +7528,12 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 			init_failed = 1;
 	}
 
+	if (!init_failed && !yaffs_SummaryInit(dev))
+		init_failed = 1;
+
+	if (!init_failed && !yaffs_ChunkIndexInit(dev))
+		init_failed = 1;
+
 	if (dev->isYaffs2)
 		dev->useHeaderFileSize = 1;
 
@@ -7390,6 +7608,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->nRetriedWrites = 0;
 
 	dev->nRetiredBlocks = 0;
+	dev->nChunkLookups = 0;
+	dev->nChunkIndexHits = 0;
+	dev->nGroupTagReads = 0;
 
 	yaffs_VerifyFreeChunks(dev);
 	yaffs_VerifyBlocks(dev);
@@ -7424,6 +7645,9 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 
 		YFREE(dev->gcCleanupList);
 
+		yaffs_SummaryDeinit(dev);
+		yaffs_ChunkIndexDeinit(dev);
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			YFREE(dev->tempBuffer[i].buffer);
 
@@ -63,7 +63,9 @@
 
 #define YAFFS_OBJECT_SPACE		0x40000
 
-#define YAFFS_CHECKPOINT_VERSION 	3
+#define YAFFS_CHECKPOINT_VERSION 	4
+
+#define YAFFS_SUMMARY_VERSION		1
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -86,9 +88,13 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summary chunks */
+#define YAFFS_OBJECTID_SUMMARY		0x30
+
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	64
+#define YAFFS_SHORT_OP_HASH_BUCKETS	32	/* Power of 2 */
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -112,9 +118,11 @@
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
 /* ChunkCache is used for short read/write operations.*/
-typedef struct {
+typedef struct yaffs_ChunkCacheStruct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
+	struct yaffs_ChunkCacheStruct *hashNext;	/* next in the srHash bucket */
+	int hashBucket;
 	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
@@ -286,6 +294,7 @@ typedef struct {
 	__u32 gcPrioritise:1; 	/* An ECC check or blank check has failed on this block.
 				   It should be prioritised for GC */
 	__u32 chunkErrorStrikes:3; /* How many times we've had ecc etc failures on this block and tried to reuse it */
+	__u32 hasSummary:1;	/* The last nSummaryChunks chunks are claimed by the summary */
 
 #ifdef CONFIG_YAFFS_YAFFS2
 	__u32 hasShrinkHeader:1; /* This block has at least one shrink object header */
@@ -427,6 +436,7 @@ struct yaffs_ObjectStruct {
 
 	__u8 serial;		/* serial number of chunk in NAND. Cached here */
 	__u16 sum;		/* sum of the name to speed searching */
+	__u32 indexSerial;	/* tells object incarnations apart in the chunk index */
 
 	struct yaffs_DeviceStruct *myDev;       /* The device I'm on */
 
@@ -513,6 +523,7 @@ typedef struct {
 	__u8 renameAllowed:1;
 	__u8 unlinkAllowed:1;
 	__u8 serial;
+	__u16 sum;
 
 	int nDataChunks;
 	__u32 fileSizeOrEquivalentObjectId;
@@ -529,6 +540,38 @@ typedef struct {
 	int maxLine;
 } yaffs_TempBuffer;
 
+/*--------------------- Block summary ----------------
+ *
+ * The last chunk(s) of a full yaffs2 block hold the tags of all the
+ * chunks before it, see yaffs_summary.c
+ */
+
+typedef struct {
+	unsigned version;
+	unsigned block;
+	unsigned sequenceNumber;
+	unsigned sum;
+} yaffs_SummaryHeader;
+
+typedef struct {
+	unsigned objectId;	/* As packed in the yaffs2 tags */
+	unsigned chunkId;
+	unsigned byteCount;
+	unsigned nameSum;	/* Name sum if this is an object header */
+} yaffs_SummaryTags;
+
+/*--------------------- Chunk index ----------------
+ *
+ * Exact NAND chunk of file data chunks, for when the tnodes only hold
+ * the chunk group, see yaffs_chunkindex.c
+ */
+
+typedef struct {
+	__u32 serial;		/* indexSerial of the object, 0 if unused */
+	int chunkInInode;
+	int chunkInNAND;
+} yaffs_ChunkIndexEntry;
+
 /*----------------- Device ---------------------------------*/
 
 struct yaffs_DeviceStruct {
@@ -602,6 +645,9 @@ struct yaffs_DeviceStruct {
 
 	int wideTnodesDisabled; /* Set to disable wide tnodes */
 
+	int summaryDisabled;	/* Set to fill blocks without writing summaries */
+	int chunkIndexBytes;	/* RAM cap for the chunk index, 0 to disable it */
+
 	YCHAR *pathDividers;	/* String of legal path dividers */
 
 
@@ -668,6 +714,21 @@ struct yaffs_DeviceStruct {
 
 	int nCheckpointBlocksRequired; /* Number of blocks needed to store current checkpoint set */
 
+	/* Block summary stuff */
+	int nSummaryChunks;	/* Chunks at the end of a block holding its summary */
+	int chunksPerSummary;	/* Chunks allocated per block, less than nChunksPerBlock
+				 * if summaries are written
+				 */
+	int summaryBlock;	/* Block the summary is collected for, -1 if none */
+	yaffs_SummaryTags *summaryTags;
+	__u8 *summaryBuffer;
+
+	/* Chunk index stuff */
+	yaffs_ChunkIndexEntry *chunkIndex;
+	__u32 chunkIndexMask;
+	int nChunkIndexEntries;
+	__u32 chunkIndexSerial;	/* last indexSerial handed out */
+
 	/* Block Info */
 	yaffs_BlockInfo *blockInfo;
 	__u8 *chunkBits;	/* bitmap of chunks in use */
@@ -725,6 +786,11 @@ struct yaffs_DeviceStruct {
 	int tagsEccUnfixed;
 	int nDeletions;
 	int nUnmarkedDeletions;
+	int nSummaryWrites;
+	int nSummaryScans;	/* Blocks scanned from their summary on mount */
+	int nChunkLookups;	/* File data chunks looked up in the tnodes */
+	int nChunkIndexHits;	/* ...of which found in the chunk index */
+	int nGroupTagReads;	/* Tag reads searching chunk groups */
 
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
@@ -741,6 +807,7 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
+	yaffs_ChunkCache *srHash[YAFFS_SHORT_OP_HASH_BUCKETS];
 	int srLastUse;
 
 	int cacheHits;
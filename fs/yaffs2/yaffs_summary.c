@@ -0,0 +1,270 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * When a yaffs2 block fills up, the tags of all its chunks are written
+ * to the last chunk(s) of the block. A scan after an unclean shutdown
+ * then reads the summary of each full block instead of the tags of
+ * every chunk in it. Blocks without a valid summary (the allocation
+ * block, blocks written by older code, or a summary that did not make
+ * it to NAND) are scanned chunk by chunk as before.
+ *
+ * Object header entries also carry the sum of the object name, so that
+ * the header itself only needs to be read when a name lookup can match.
+ */
+
+const char *yaffs_summary_c_version =
+	"$Id$";
+
+#include "yaffs_summary.h"
+#include "yaffs_packedtags2.h"
+#include "yaffs_nand.h"
+#include "yaffs_getblockinfo.h"
+
+static __u32 yaffs_SummarySum(const yaffs_SummaryTags *st, int nEntries)
+{
+	const __u8 *p = (const __u8 *)st;
+	int nBytes = nEntries * sizeof(yaffs_SummaryTags);
+	__u32 sum = 0;
+	__u8 xor = 0;
+
+	while (nBytes--) {
+		sum += *p;
+		xor ^= *p;
+		p++;
+	}
+
+	return (sum << 8) | xor;
+}
+
+int yaffs_SummaryInit(yaffs_Device *dev)
+{
+	int n;
+
+	dev->nSummaryChunks = 0;
+	dev->chunksPerSummary = dev->nChunksPerBlock;
+	dev->summaryBlock = -1;
+	dev->summaryTags = NULL;
+	dev->summaryBuffer = NULL;
+	dev->nSummaryWrites = 0;
+	dev->nSummaryScans = 0;
+
+	if (!dev->isYaffs2)
+		return YAFFS_OK;
+
+	/* Find the fewest chunks that hold the tags of the rest of the block */
+	for (n = 1; n < dev->nChunksPerBlock / 2; n++)
+		if (sizeof(yaffs_SummaryHeader) +
+		    (dev->nChunksPerBlock - n) * sizeof(yaffs_SummaryTags) <=
+		    n * dev->nDataBytesPerChunk)
+			break;
+
+	if (n >= dev->nChunksPerBlock / 2) {
+		/* Tiny blocks, not worth it */
+		return YAFFS_OK;
+	}
+
+	dev->nSummaryChunks = n;
+
+	/*
+	 * Always able to read summaries, only write them if allowed.
+	 * With inband tags whole chunks get read into the buffer.
+	 */
+	dev->summaryBuffer = YMALLOC(n * dev->totalBytesPerChunk);
+	if (!dev->summaryBuffer)
+		return YAFFS_FAIL;
+
+	if (dev->summaryDisabled)
+		return YAFFS_OK;
+
+	dev->summaryTags = YMALLOC((dev->nChunksPerBlock - n) *
+				   sizeof(yaffs_SummaryTags));
+	if (!dev->summaryTags) {
+		yaffs_SummaryDeinit(dev);
+		return YAFFS_FAIL;
+	}
+
+	dev->chunksPerSummary = dev->nChunksPerBlock - n;
+
+	return YAFFS_OK;
+}
+
+void yaffs_SummaryDeinit(yaffs_Device *dev)
+{
+	if (dev->summaryTags)
+		YFREE(dev->summaryTags);
+	if (dev->summaryBuffer)
+		YFREE(dev->summaryBuffer);
+	dev->summaryTags = NULL;
+	dev->summaryBuffer = NULL;
+	dev->summaryBlock = -1;
+}
+
+static void yaffs_SummaryWrite(yaffs_Device *dev, int blk)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	yaffs_SummaryHeader hdr;
+	yaffs_ExtendedTags tags;
+	int nEntries = dev->chunksPerSummary;
+	int nBytes = sizeof(hdr) + nEntries * sizeof(yaffs_SummaryTags);
+	int chunk = blk * dev->nChunksPerBlock + nEntries;
+	__u8 *buffer = dev->summaryBuffer;
+	int i;
+
+	dev->summaryBlock = -1;
+
+	/* Don't bother for a block on its way out */
+	if (bi->needsRetiring)
+		return;
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.sequenceNumber = bi->sequenceNumber;
+	hdr.sum = yaffs_SummarySum(dev->summaryTags, nEntries);
+
+	memset(buffer, 0xFF, dev->nSummaryChunks * dev->nDataBytesPerChunk);
+	memcpy(buffer, &hdr, sizeof(hdr));
+	memcpy(buffer + sizeof(hdr), dev->summaryTags,
+	       nEntries * sizeof(yaffs_SummaryTags));
+
+	for (i = 0; i < dev->nSummaryChunks; i++) {
+		yaffs_InitialiseTags(&tags);
+		tags.chunkUsed = 1;
+		tags.objectId = YAFFS_OBJECTID_SUMMARY;
+		tags.chunkId = i + 1;
+		tags.byteCount = (nBytes > dev->nDataBytesPerChunk) ?
+				 dev->nDataBytesPerChunk : nBytes;
+		tags.sequenceNumber = bi->sequenceNumber;
+
+		/*
+		 * Written in place, the block sequence is not the current one.
+		 * The mtd interface counts the write in dev->nPageWrites.
+		 */
+		if (dev->writeChunkWithTagsToNAND(dev,
+				chunk + i - dev->chunkOffset,
+				buffer + i * dev->nDataBytesPerChunk,
+				&tags) != YAFFS_OK) {
+			/* A failed program: move the data out and retire it */
+			yaffs_HandleChunkError(dev, bi);
+			bi->needsRetiring = 1;
+			T(YAFFS_TRACE_ERROR | YAFFS_TRACE_BAD_BLOCKS,
+			  (TSTR("**>> yaffs summary write failed, block %d"
+			  " needs retiring" TENDSTR), blk));
+			return;
+		}
+		nBytes -= tags.byteCount;
+	}
+
+	dev->nSummaryWrites++;
+}
+
+/*
+ * Called when a new allocation block is picked. If the last chunk of
+ * the previous block failed to write, its summary is still pending.
+ */
+void yaffs_SummaryStart(yaffs_Device *dev, int blk)
+{
+	if (!dev->summaryTags)
+		return;
+
+	if (dev->summaryBlock >= 0 &&
+	    yaffs_GetBlockInfo(dev, dev->summaryBlock)->blockState ==
+	    YAFFS_BLOCK_STATE_FULL)
+		yaffs_SummaryWrite(dev, dev->summaryBlock);
+
+	memset(dev->summaryTags, 0xFF,
+	       dev->chunksPerSummary * sizeof(yaffs_SummaryTags));
+	dev->summaryBlock = blk;
+}
+
+void yaffs_SummaryAdd(yaffs_Device *dev, const yaffs_ExtendedTags *tags,
+			int chunkInNAND, __u16 nameSum)
+{
+	yaffs_PackedTags2TagsPart pt;
+	yaffs_SummaryTags *st;
+	int blk = chunkInNAND / dev->nChunksPerBlock;
+	int c = chunkInNAND % dev->nChunksPerBlock;
+
+	/* Only for the block collected since it was started */
+	if (blk != dev->summaryBlock || c >= dev->chunksPerSummary)
+		return;
+
+	yaffs_PackTags2TagsPart(&pt, tags);
+
+	st = &dev->summaryTags[c];
+	st->objectId = pt.objectId;
+	st->chunkId = pt.chunkId;
+	st->byteCount = pt.byteCount;
+	st->nameSum = nameSum;
+
+	if (c == dev->chunksPerSummary - 1)
+		yaffs_SummaryWrite(dev, blk);
+}
+
+int yaffs_SummaryRead(yaffs_Device *dev, int blk)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	yaffs_SummaryHeader hdr;
+	yaffs_ExtendedTags tags;
+	int nEntries = dev->nChunksPerBlock - dev->nSummaryChunks;
+	int chunk = blk * dev->nChunksPerBlock + nEntries;
+	int i;
+
+	if (!dev->summaryBuffer)
+		return YAFFS_FAIL;
+
+	for (i = 0; i < dev->nSummaryChunks; i++) {
+		yaffs_ReadChunkWithTagsFromNAND(dev, chunk + i,
+				dev->summaryBuffer + i * dev->nDataBytesPerChunk,
+				&tags);
+		if (!tags.chunkUsed ||
+		    tags.eccResult > YAFFS_ECC_RESULT_FIXED ||
+		    tags.objectId != YAFFS_OBJECTID_SUMMARY ||
+		    tags.chunkId != i + 1 ||
+		    tags.sequenceNumber != bi->sequenceNumber)
+			return YAFFS_FAIL;
+	}
+
+	memcpy(&hdr, dev->summaryBuffer, sizeof(hdr));
+
+	if (hdr.version != YAFFS_SUMMARY_VERSION ||
+	    hdr.block != blk ||
+	    hdr.sequenceNumber != bi->sequenceNumber ||
+	    hdr.sum != yaffs_SummarySum((yaffs_SummaryTags *)
+				(dev->summaryBuffer + sizeof(hdr)), nEntries)) {
+		T(YAFFS_TRACE_SCAN,
+		  (TSTR("Block %d summary does not check out" TENDSTR), blk));
+		return YAFFS_FAIL;
+	}
+
+	return YAFFS_OK;
+}
+
+/* Tags of a chunk in the block last read by yaffs_SummaryRead() */
+void yaffs_SummaryFetch(yaffs_Device *dev, int chunkInBlock,
+			yaffs_ExtendedTags *tags, __u16 *nameSum)
+{
+	yaffs_SummaryHeader *hdr = (yaffs_SummaryHeader *)dev->summaryBuffer;
+	yaffs_SummaryTags *st = (yaffs_SummaryTags *)
+			(dev->summaryBuffer + sizeof(*hdr)) + chunkInBlock;
+	yaffs_PackedTags2TagsPart pt;
+
+	/* Chunks that were skipped or failed keep an erased entry */
+	pt.sequenceNumber = (st->objectId == 0xFFFFFFFF) ?
+			    0xFFFFFFFF : hdr->sequenceNumber;
+	pt.objectId = st->objectId;
+	pt.chunkId = st->chunkId;
+	pt.byteCount = st->byteCount;
+
+	yaffs_UnpackTags2TagsPart(tags, &pt);
+	tags->eccResult = YAFFS_ECC_RESULT_NO_ERROR;
+
+	*nameSum = st->nameSum;
+}
@@ -0,0 +1,29 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+#ifndef __YAFFS_SUMMARY_H__
+#define __YAFFS_SUMMARY_H__
+
+#include "yaffs_guts.h"
+
+int yaffs_SummaryInit(yaffs_Device *dev);
+void yaffs_SummaryDeinit(yaffs_Device *dev);
+
+/* Collecting the summary of the allocation block */
+void yaffs_SummaryStart(yaffs_Device *dev, int blk);
+void yaffs_SummaryAdd(yaffs_Device *dev, const yaffs_ExtendedTags *tags,
+			int chunkInNAND, __u16 nameSum);
+
+/* Using it during the scan */
+int yaffs_SummaryRead(yaffs_Device *dev, int blk);
+void yaffs_SummaryFetch(yaffs_Device *dev, int chunkInBlock,
+			yaffs_ExtendedTags *tags, __u16 *nameSum);
+
+#endif
@@ -59,4 +59,43 @@ enum android_alarm_return_flags {
 #define ANDROID_ALARM_BASE_CMD(cmd)         (cmd & ~(_IOC(0, 0, 0xf0, 0)))
 #define ANDROID_ALARM_IOCTL_TO_TYPE(cmd)    (_IOC_NR(cmd) >> 4)
 
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+
+/*
+ * In-kernel wakeup: the rtc alarm is programmed so the system resumes
+ * from suspend no later than @expires (CLOCK_REALTIME, like
+ * ANDROID_ALARM_RTC_WAKEUP).  Nothing is called on expiry; the client
+ * runs its own CLOCK_REALTIME hrtimer, which fires once the system
+ * is awake, and must take a wake lock before the rtc wake lock times
+ * out.
+ */
+struct android_alarm_wakeup {
+	struct list_head entry;
+	struct timespec expires;
+};
+
+static inline void android_alarm_wakeup_init(struct android_alarm_wakeup *w)
+{
+	INIT_LIST_HEAD(&w->entry);
+}
+
+#ifdef CONFIG_RTC_INTF_ALARM
+void android_alarm_wakeup_set(struct android_alarm_wakeup *w,
+			      struct timespec expires);
+void android_alarm_wakeup_cancel(struct android_alarm_wakeup *w);
+#else
+static inline void android_alarm_wakeup_set(struct android_alarm_wakeup *w,
+					    struct timespec expires)
+{
+}
+
+static inline void android_alarm_wakeup_cancel(struct android_alarm_wakeup *w)
+{
+}
+#endif
+
+#endif /* __KERNEL__ */
+
 #endif
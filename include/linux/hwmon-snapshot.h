@@ -0,0 +1,83 @@
+/*
+ * include/linux/hwmon-snapshot.h - one-shot capture of all hwmon channels
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#ifndef _LINUX_HWMON_SNAPSHOT_H
+#define _LINUX_HWMON_SNAPSHOT_H
+
+#include <linux/types.h>
+
+#define HWMON_SNAPSHOT_NAME_LEN	24
+
+/*
+ * Each read() of /dev/hwmon_snapshot captures every registered channel
+ * and returns one record: struct hwmon_snapshot followed by @count
+ * struct hwmon_snapshot_value.  A buffer too small for the whole record
+ * gets -EINVAL.
+ */
+struct hwmon_snapshot {
+	__s64 timestamp;	/* CLOCK_MONOTONIC as conversions start, ns */
+	__u32 count;		/* values following the header */
+	__u32 value_size;	/* sizeof(struct hwmon_snapshot_value) */
+};
+
+struct hwmon_snapshot_value {
+	char  name[HWMON_SNAPSHOT_NAME_LEN];	/* "<source>:<channel>" */
+	__s32 value;		/* in the unit of the hwmon attribute */
+	__s32 status;		/* 0, or negative errno; @value is 0 then */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <asm/atomic.h>
+
+/**
+ * struct hwmon_snapshot_source - a set of channels sampled together
+ * @name: source name, first part of the value names
+ * @channels: channel names, second part of the value names; the hwmon
+ *	attribute name without "_input" by convention
+ * @nchannels: number of @channels
+ * @prepare: optional; start a conversion for the next @read without
+ *	waiting for it.  Sources that take long to sample provide it, so
+ *	that a capture waits for all of them at once.
+ * @read: fill in one value per channel; called in process context and
+ *	may sleep, also by several captures at once.  Returns 0, or
+ *	negative errno for all channels.
+ * @list: on the snapshot source list
+ * @users: captures holding the source
+ */
+struct hwmon_snapshot_source {
+	const char		*name;
+	const char * const	*channels;
+	unsigned int		nchannels;
+	void			(*prepare)(struct hwmon_snapshot_source *src);
+	int			(*read)(struct hwmon_snapshot_source *src,
+					s32 *vals);
+	struct list_head	list;
+	atomic_t		users;
+};
+
+#ifdef CONFIG_HWMON_SNAPSHOT
+extern int hwmon_snapshot_register(struct hwmon_snapshot_source *src);
+extern void hwmon_snapshot_unregister(struct hwmon_snapshot_source *src);
+#else
+static inline int hwmon_snapshot_register(struct hwmon_snapshot_source *src)
+{
+	return 0;
+}
+
+static inline void hwmon_snapshot_unregister(struct hwmon_snapshot_source *src)
+{
+}
+#endif
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LINUX_HWMON_SNAPSHOT_H */
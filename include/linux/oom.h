@@ -13,6 +13,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -30,5 +31,21 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask, int order);
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+/*
+ * Events of the oom_adj notifier, which is passed the task and called in
+ * atomic context.  Only thread group leaders are reported as forked, so a
+ * thread that exec()s takes over the process with OOM_ADJ_LEADER.
+ */
+enum oom_adj_event {
+	OOM_ADJ_FORKED,		/* new process, with its parent's adj */
+	OOM_ADJ_CHANGED,	/* written through /proc/<pid>/oom_adj */
+	OOM_ADJ_EXITING,	/* in do_exit(), before the mm is dropped */
+	OOM_ADJ_LEADER,		/* new leader after the old one exited in exec */
+};
+
+extern int register_oom_adj_notifier(struct notifier_block *nb);
+extern int unregister_oom_adj_notifier(struct notifier_block *nb);
+extern void oom_adj_notify(struct task_struct *p, enum oom_adj_event event);
+
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
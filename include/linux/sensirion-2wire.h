@@ -0,0 +1,61 @@
+/*
+ * include/linux/sensirion-2wire.h - Sensirion SHTxx 2-wire bus on GPIOs
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#ifndef _LINUX_SENSIRION_2WIRE_H
+#define _LINUX_SENSIRION_2WIRE_H
+
+#include <linux/types.h>
+
+/**
+ * struct sensirion_2wire_platform_data - one sensor on a pair of GPIOs
+ * @sck_gpio: GPIO driving SCK (push-pull output)
+ * @data_gpio: GPIO on DATA; driven low or released to the pull-up,
+ *	also used as the falling-edge data-ready interrupt
+ * @udelay: SCK half period in microseconds, 0 selects the default
+ */
+struct sensirion_2wire_platform_data {
+	unsigned int	sck_gpio;
+	unsigned int	data_gpio;
+	unsigned int	udelay;
+};
+
+#ifdef __KERNEL__
+
+/* default SCK half period, ~250kHz is well below the 1MHz limit */
+#define SENSIRION_2WIRE_UDELAY	2
+
+/**
+ * struct sensirion_2wire - bus instance
+ * @sck: SCK GPIO
+ * @data: DATA GPIO
+ * @udelay: SCK half period in microseconds
+ */
+struct sensirion_2wire {
+	unsigned int	sck;
+	unsigned int	data;
+	unsigned int	udelay;
+};
+
+extern int sensirion_2wire_init(struct sensirion_2wire *bus,
+		const struct sensirion_2wire_platform_data *pdata,
+		const char *label);
+extern void sensirion_2wire_free(struct sensirion_2wire *bus);
+
+extern void sensirion_2wire_reset(struct sensirion_2wire *bus);
+extern void sensirion_2wire_start(struct sensirion_2wire *bus);
+extern int sensirion_2wire_write_byte(struct sensirion_2wire *bus, u8 byte);
+extern u8 sensirion_2wire_read_byte(struct sensirion_2wire *bus, int ack);
+
+extern int sensirion_2wire_data_ready(struct sensirion_2wire *bus);
+extern int sensirion_2wire_to_irq(struct sensirion_2wire *bus);
+
+#endif	/* __KERNEL__ */
+
+#endif	/* _LINUX_SENSIRION_2WIRE_H */
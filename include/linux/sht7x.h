@@ -0,0 +1,50 @@
+/*
+ * include/linux/sht7x.h - Sensirion sample stream (/dev/sht7x, /dev/sht21-*)
+ *
+ * Copyright (C) 2011 Moko365 Inc.
+ *
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License. See the file "COPYING" in the main directory of this
+ * archive for more details.
+ */
+
+#ifndef _LINUX_SHT7X_H
+#define _LINUX_SHT7X_H
+
+#include <linux/types.h>
+
+/*
+ * One measurement cycle as produced by the in-kernel sampler.  read()
+ * on the sensor's misc device returns an array of these; the same records are laid
+ * out after struct sht7x_ring in the read-only mmap() view.
+ */
+struct sht7x_sample {
+	__s64 timestamp;	/* CLOCK_MONOTONIC at start of cycle, ns */
+	__s32 temperature;	/* milli celsius, as temp1_input */
+	__s32 humidity;		/* per cent mille, as humidity1_input */
+	__u16 raw_t;		/* raw temperature ticks */
+	__u16 raw_rh;		/* raw humidity ticks */
+	__s32 status;		/* 0, or negative errno of a failed cycle */
+};
+
+/*
+ * Header at offset 0 of the mmap() view.  Records live at byte offset
+ * @offset; the record for sequence number n is at slot n % @slots.
+ * @head is the number of records produced so far: a reader that
+ * remembers its own tail consumes records [tail, head).  The slot of
+ * record n is recycled as soon as @head reaches n + slots, so after
+ * copying record n a reader must re-read @head and discard the copy if
+ * head - n >= slots.
+ */
+struct sht7x_ring {
+	__u32 head;		/* records produced, free running */
+	__u32 slots;		/* ring size in records, power of two */
+	__u32 offset;		/* byte offset of the first record */
+	__u32 sample_size;	/* sizeof(struct sht7x_sample) */
+};
+
+#ifdef __KERNEL__
+#define SHT7X_RING_SLOTS	1024
+#endif
+
+#endif	/* _LINUX_SHT7X_H */
@@ -26,6 +26,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/ptrace.h>
 #include <linux/profile.h>
+#include <linux/oom.h>
 #include <linux/mount.h>
 #include <linux/proc_fs.h>
 #include <linux/kthread.h>
@@ -1048,6 +1049,8 @@ NORET_TYPE void do_exit(long code)
 	smp_mb();
 	spin_unlock_wait(&tsk->pi_lock);
 
+	oom_adj_notify(tsk, OOM_ADJ_EXITING);
+
 	if (unlikely(in_atomic()))
 		printk(KERN_INFO "note: %s[%d] exited with preempt_count %d\n",
 				current->comm, task_pid_nr(current),